@@ -20,52 +20,76 @@ config.grid.color.selected = "#6666FF66"
 config.grid.leeway.horizontal = 200
 config.grid.leeway.vertical   = 200
 
+-- window rules --------------------------------------------------------------
+
+config.window.rules = {
+    { app_id = "io.missioncenter.MissionCenter", radius = 15 },
+    { app_id = "org.gnome.Nautilus",             radius = 15 },
+    { app_id = "it.mijorus.gearlever",           radius = 15 },
+    { app_id = "zenity",                         radius = 18 },
+
+    -- firefox restores all of its windows on relaunch, unless they are closed individually
+    { app_id = "firefox", radius = { top_left = 5, top_right = 5 }, close_on_quit = false },
+
+    { namespace = "waybar", border = true },
+}
+
+-- keyboard --------------------------------------------------------------------
+
+config.keyboard.layout = "gb"
+
+-- pointer ---------------------------------------------------------------------
+
+config.pointer.profile["default"] = { {0, 0.3}, {2, 0.3}, {22, 0.6} }
+config.pointer.accel     = "default"
+config.pointer.rel_accel = "relative"
+
 -- audio control ---------------------------------------------------------------
 
-config.bind["XF86AudioLowerVolume"] = function() spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "0.01-")  end
-config.bind["XF86AudioRaiseVolume"] = function() spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "0.01+")  end
-config.bind["XF86AudioMute"]        = function() spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "toggle") end
+config.bind["XF86AudioLowerVolume"] = action.spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "0.01-")
+config.bind["XF86AudioRaiseVolume"] = action.spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "0.01+")
+config.bind["XF86AudioMute"]        = action.spawn("wpctl", "set-volume", "@DEFAULT_AUDIO_SINK@", "toggle")
 
 -- playerctl -------------------------------------------------------------------
 
-config.bind["XF86AudioPlay"] = function() spawn("playerctl", "play-pause") end
-config.bind["XF86AudioPrev"] = function() spawn("playerctl", "previous")   end
-config.bind["XF86AudioNext"] = function() spawn("playerctl", "next")       end
+config.bind["XF86AudioPlay"] = action.spawn("playerctl", "play-pause")
+config.bind["XF86AudioPrev"] = action.spawn("playerctl", "previous")
+config.bind["XF86AudioNext"] = action.spawn("playerctl", "next")
 
 -- launcher --------------------------------------------------------------------
 
-config.bind["Mod+d"]       = function() spawn("rofi", "-show-icons", "-show", "drun")   end
-config.bind["Mod+Shift+D"] = function() spawn("rofi", "-show-icons", "-show", "run")    end
-config.bind["Mod+Ctrl+d"]  = function() spawn("rofi", "-show-icons", "-show", "window") end
+config.bind["Mod+d"]       = action.spawn("rofi", "-show-icons", "-show", "drun")
+config.bind["Mod+Shift+D"] = action.spawn("rofi", "-show-icons", "-show", "run")
+config.bind["Mod+Ctrl+d"]  = action.spawn("rofi", "-show-icons", "-show", "window")
 
 -- clipboard -------------------------------------------------------------------
 
-config.bind["Mod+x"]       = function() spawn("sh", "-c", "cliphist list | rofi -dmenu | cliphist decode | wl-copy") end
-config.bind["Mod+Ctrl+x"]  = function() spawn("sh", "-c", "cliphist list | rofi -dmenu | cliphist delete -") end
-config.bind["Mod+Shift+X"] = function() spawn("cliphist", "wipe") end
+config.bind["Mod+x"]       = action.spawn("sh", "-c", "cliphist list | rofi -dmenu | cliphist decode | wl-copy")
+config.bind["Mod+Ctrl+x"]  = action.spawn("sh", "-c", "cliphist list | rofi -dmenu | cliphist delete -")
+config.bind["Mod+Shift+X"] = action.spawn("cliphist", "wipe")
 
 -- applications ----------------------------------------------------------------
 
-config.bind["Mod+t"]       = function() spawn("konsole") end
+config.bind["Mod+t"]       = action.spawn("konsole")
 config.bind["Mod+Shift+T"] = function() spawn("konsole", "--workdir", process.cwd) end
-config.bind["Mod+g"]       = function() spawn("dolphin") end
-config.bind["Mod+h"]       = function() spawn("kalk")    end
+config.bind["Mod+g"]       = action.spawn("dolphin")
+config.bind["Mod+h"]       = action.spawn("kalk")
 
 -- managers --------------------------------------------------------------------
 
-config.bind["Mod+v"] = function() spawn("pavucontrol")     end
-config.bind["Mod+b"] = function() spawn("blueman-manager") end
+config.bind["Mod+v"] = action.spawn("pavucontrol")
+config.bind["Mod+b"] = action.spawn("blueman-manager")
 
 -- capture ---------------------------------------------------------------------
 
-config.bind["Print"] = function() spawn("sh", "-c", "grim -g \"$(slurp)\" - | wl-copy") end
+config.bind["Print"] = action.spawn("sh", "-c", "grim -g \"$(slurp)\" - | wl-copy")
 
 -- system ----------------------------------------------------------------------
 
-config.bind["Mod+n"] = function() spawn("systemctl", "suspend") end
+config.bind["Mod+n"] = action.spawn("systemctl", "suspend")
 
 -- debug -----------------------------------------------------------------------
 
-config.bind["Mod+i"] = function() spawn("xeyes")     end
+config.bind["Mod+i"] = action.spawn("xeyes")
 config.bind["Mod+o"] = function() debug.output.new() end
 config.bind["Mod+k"] = function() debug.cursor = not debug.cursor end
@@ -4,6 +4,7 @@ void background_destroy(Server* server)
 {
     if (server) {
         wlr_buffer_drop(server->background);
+        server->background = nullptr;
     }
 }
 
@@ -11,6 +12,14 @@ void background_set(Server* server, const char* path)
 {
     background_destroy(server);
 
+    if (!*path) {
+        // Empty path clears the background image
+        for (auto* output : server->outputs) {
+            background_output_set(output);
+        }
+        return;
+    }
+
     i32 w, h, num_channels;
     stbi_uc* data = stbi_load(path, &w, &h, &num_channels, STBI_rgb_alpha);
     defer { stbi_image_free(data); };
@@ -31,6 +40,7 @@ void background_output_destroy(Output* output)
 {
     if (output->background_image) {
         wlr_scene_node_destroy(&output->background_image->node);
+        output->background_image = nullptr;
     }
 }
 
@@ -84,6 +84,7 @@ bool bind_trigger(Server* server, Bind input_action)
                 // Consume opposite action but do not trigger command
                 return true;
             }
+            ipc_publish_bind(server, cb.name);
             cb.function();
             return true;
         }
@@ -3,23 +3,6 @@
 void border_manager_create(Server* server)
 {
     server->border_manager = new BorderManager {};
-
-    // TODO: Configurable window rules
-
-    auto& rules = server->border_manager->corner_radius_rules;
-
-    rules["io.missioncenter.MissionCenter"] = {{15, 15, 15, 15}};
-    rules["org.gnome.Nautilus"]             = {{15, 15, 15, 15}};
-    rules["it.mijorus.gearlever"]           = {{15, 15, 15, 15}};
-
-    rules["zenity"] = {{18, 18, 18, 18}};
-
-    rules["firefox"] = EnumMap<i32, BorderCorners>::make({
-        {BorderCorners::TopLeft,  5},
-        {BorderCorners::TopRight, 5},
-        {BorderCorners::BottomLeft,  BorderUnset},
-        {BorderCorners::BottomRight, BorderUnset},
-    });
 }
 
 static
@@ -104,26 +87,11 @@ void border_apply_rules(Surface* surface)
 {
     auto* m = surface->server->border_manager;
 
-    surface->border.show = false;
-    surface->border.radius = {m->border_radius, m->border_radius, m->border_radius, m->border_radius};
-
-    if (Toplevel* toplevel = Toplevel::from(surface)) {
-        surface->border.show = true;
-        auto radius_rules = m->corner_radius_rules.find(toplevel->app_id());
-        if (radius_rules != m->corner_radius_rules.end()) {
-            surface->border.radius = radius_rules->second;
-            for (auto& e : surface->border.radius._data) {
-                if (e == BorderUnset) e = m->border_radius;
-            }
-        }
-    } else if (LayerSurface* layer_surface = LayerSurface::from(surface)) {
-        std::string_view namespace_ = layer_surface->wlr_layer_surface()->namespace_ ?: "";
-        if (namespace_ == "waybar") {
-            surface->border.show = true;
-        }
-    }
+    surface->border.show = surface->rules.border;
+    surface->border.radius = surface->rules.radius;
 
     for (auto& e : surface->border.radius._data) {
+        if (e == BorderUnset) e = m->border_radius;
         if (e == BorderUnset) e = BorderSharp;
     }
 }
@@ -11,6 +11,7 @@ static constexpr u32 xcursor_size = 24;
 struct LayoutConfig
 {
     fvec4 background_color = { 0, 0, 0, 1 };
+    std::string background_image;
 
     f32 focus_cycle_unselected_opacity = 0.0;
 
@@ -34,15 +35,44 @@ static constexpr const char* keyboard_layout       = "gb";
 static constexpr i32         keyboard_repeat_rate  =  25;
 static constexpr i32         keyboard_repeat_delay = 600;
 
-struct PointerAccelConfig
+struct KeyboardConfig
 {
-    f64 offset;
-    f64 rate;
-    f64 multiplier;
+    std::string layout = keyboard_layout;
+
+    // Per-device layout overrides, keyed by input device name
+    ankerl::unordered_dense::map<std::string, std::string> device_layouts;
+};
+
+static constexpr usz pointer_accel_table_size = 64;
+
+struct PointerAccelProfile
+{
+    // Control points as (speed, sensitivity) pairs, sorted by speed
+    std::vector<vec2> points;
+
+    // Sensitivity sampled at uniform speed intervals, interpolated between samples.
+    // Speeds past the last control point extrapolate along the last segment
+    std::array<f64, pointer_accel_table_size> table;
+    f64 step;
+    f64 tail_slope;
 };
 
-static constexpr PointerAccelConfig pointer_accel     = { 2.0, 0.05, 0.3 };
-static constexpr PointerAccelConfig pointer_rel_accel = { 2.0, 0.05, 1.0 };
+struct PointerDeviceConfig
+{
+    std::string accel;
+    std::string rel_accel;
+};
+
+struct PointerConfig
+{
+    std::string accel     = "default";
+    std::string rel_accel = "relative";
+
+    // Per-device profile overrides, keyed by input device name
+    ankerl::unordered_dense::map<std::string, PointerDeviceConfig> devices;
+
+    ankerl::unordered_dense::map<std::string, std::shared_ptr<const PointerAccelProfile>> profiles;
+};
 
 static constexpr f64 pointer_abs_to_rel_speed_multiplier = 5;
 
@@ -97,7 +127,18 @@ struct Bind
 struct CommandBind
 {
     Bind bind;
+    std::string name;
+    std::function<void()> function;
+};
+
+// Native bind action, invoked directly from bind_trigger without entering Lua
+struct BindAction
+{
+    std::string name;
     std::function<void()> function;
+
+    // Modifiers the bind must hold, e.g. the focus cycle only ends when the main modifier is released
+    Modifiers required_modifiers = {};
 };
 
 enum class BorderEdges : u32
@@ -159,20 +200,314 @@ struct Keyboard;
 struct Pointer;
 struct Client;
 struct BorderManager;
+struct ScriptWorkerPool;
+
+// Plain copy of read-mostly config, exposed to Lua through LuaJIT FFI.
+// Layout must match the cdef in script.cpp
+struct ScriptConfigView
+{
+    i32 border_width;
+    i32 border_radius;
+    f32 border_color_focused[4];
+    f32 border_color_unfocused[4];
+
+    u32 grid_width;
+    u32 grid_height;
+    i32 grid_leeway_horizontal;
+    i32 grid_leeway_vertical;
+    i32 grid_pad_inner;
+    i32 grid_pad_left;
+    i32 grid_pad_top;
+    i32 grid_pad_right;
+    i32 grid_pad_bottom;
+
+    f32 focus_cycle_opacity;
+};
+
+struct ScriptHeapSource
+{
+    std::string name;
+    u64 bytes;
+    u64 allocations;
+};
+
+// Accounting allocator for the main Lua state. Small allocations are served from
+// size-classed free lists carved out of large blocks, larger ones go to malloc
+struct ScriptHeap
+{
+    static constexpr usz small_size_step = 16;
+    static constexpr usz small_size_max  = 256;
+    static constexpr usz block_size      = 64 * 1024;
+
+    std::array<void*, small_size_max / small_size_step> free_lists;
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte* block_cursor;
+    usz block_remaining;
+
+    usz total;
+    usz peak;
+    usz limit;
+
+    // Heap size after the last completed collection cycle
+    usz gc_baseline;
+
+    // The collector can't run from inside the allocator, so crossing the limit
+    // requests a full collection from the budget hook. Allocations are only
+    // refused once that collection has shown the live data is over the limit
+    bool limit_collect_pending;
+    bool limit_reached;
+
+    // Allocations are attributed to whichever script source is currently running
+    std::vector<ScriptHeapSource> sources = {{ .name = "other" }};
+    StringMap<u32> source_index;
+    u32 current_source;
+};
+
+void* script_heap_alloc(void* ud, void* ptr, usz osize, usz nsize);
+
+enum class ScriptTaskWait : u32
+{
+    none,
+    resume,
+    sleep,
+    window,
+    output,
+    process,
+    worker,
+};
+
+// A coroutine started with `async`, suspended until the event it waits on fires
+struct ScriptTask
+{
+    Server* server;
+
+    sol::thread    thread;
+    sol::coroutine coroutine;
+
+    ScriptTaskWait   wait;
+    wl_event_source* source;
+    i32              pidfd = -1;
+
+    std::string app_id;
+    std::string title;
+    std::string output;
+
+    sol::object resume_value;
+
+    // Started while loading the config (or from another such task), cancelled on reload
+    bool config;
+};
+
+struct ScriptEnvironment
+{
+    sol::environment env;
+    u64 last_used;
+
+    // Something from the config was loaded in it, never evicted
+    bool config;
+};
+
+enum class ScriptHookType : u32
+{
+    map,
+    unmap,
+    focus,
+    title,
+    output,
+};
+
+struct ScriptHook
+{
+    sol::protected_function function;
+
+    std::chrono::nanoseconds total;
+    u64 calls;
+    u32 slow_calls;
+};
+
+// Accumulated stats of hooks that have been removed or replaced
+struct ScriptHookRetired
+{
+    std::chrono::nanoseconds total;
+    u64 calls;
+    u32 hooks;
+};
+
+struct ScriptHookEvent
+{
+    ScriptHookType type;
+    u64 window_id;
+    std::string app_id;
+    std::string title;
+    std::string output;
+    bool added;
+};
+
+// Immutable per-window state shared with Lua. Replaced (not modified) when the
+// window changes, so userdata handed out earlier keeps a consistent view
+struct ScriptWindow
+{
+    u64 id;
+    std::string app_id;
+    std::string title;
+    wlr_box bounds;
+    std::vector<std::string> outputs;
+    bool focused;
+};
+
+struct ScriptWindowSnapshot
+{
+    std::vector<std::shared_ptr<ScriptWindow>> windows;
+    // Window userdata, pushed once per snapshot. Fields are read-only
+    std::vector<sol::object> objects;
+    StringMap<std::vector<u32>> by_app_id;
+    StringMap<std::vector<u32>> by_output;
+};
+
+enum class ConfigDirty : u32
+{
+    borders    = 1 << 0,
+    opacity    = 1 << 1,
+    workarea   = 1 << 2,
+    background = 1 << 3,
+    keymaps    = 1 << 4,
+    pointer    = 1 << 5,
+};
+DECORATE_FLAG_ENUM(ConfigDirty)
+
+// Read-only snapshot of compositor state, published in a memfd for external readers.
+// Readers locate it through $ZEN_STATE and read under the seqlock: retry while
+// `sequence` is odd or changes across the read. Layout is fixed per `version`
+
+static constexpr u32 state_snapshot_magic         = 0x534e455a; // "ZENS"
+static constexpr u32 state_snapshot_version       = 1;
+static constexpr u32 state_snapshot_max_outputs   = 16;
+static constexpr u32 state_snapshot_max_toplevels = 512;
+
+struct StateSnapshotOutput
+{
+    char name[32];
+    i32  x, y, width, height;
+    f32  scale;
+    u32  _pad;
+};
+
+enum class StateSnapshotToplevelFlags : u32
+{
+    focused    = 1 << 0,
+    fullscreen = 1 << 1,
+};
+DECORATE_FLAG_ENUM(StateSnapshotToplevelFlags)
+
+struct StateSnapshotToplevel
+{
+    u64  id;
+    char app_id[64];
+    char title[128];
+    i32  x, y, width, height;
+    u32  output;
+    StateSnapshotToplevelFlags flags;
+};
+
+struct StateSnapshot
+{
+    u32 magic;
+    u32 version;
+    u32 size;
+    u32 _pad;
+
+    alignas(std::atomic_ref<u64>::required_alignment) u64 sequence;
+
+    InteractionMode interaction_mode;
+    i32 focused;
+    u32 output_count;
+    u32 toplevel_count;
+
+    StateSnapshotOutput   outputs[state_snapshot_max_outputs];
+    StateSnapshotToplevel toplevels[state_snapshot_max_toplevels];
+};
+
+struct FocusCycleCandidate
+{
+    Weak<Toplevel> toplevel;
+
+    // Part of a parent/child group, which must be restacked together
+    bool has_family;
+};
 
 struct Server
 {
     struct {
-        LayoutConfig layout;
+        LayoutConfig   layout;
+        KeyboardConfig keyboard;
+        PointerConfig  pointer;
     } config;
 
     ListenerSet listeners;
 
     struct {
-        sol::state lua;
+        ScriptHeap heap;
+        sol::state lua { sol::default_at_panic, script_heap_alloc, &heap };
         std::filesystem::path current_script_dir;
 
         std::function<void(Output*, bool)> on_output_add_or_remove = [](Output*, bool){};
+
+        // Script environments per source directory. Environments the config loaded
+        // in are kept, the rest are evicted least recently used first
+        ankerl::unordered_dense::map<std::string, ScriptEnvironment> environments;
+        u64 environment_clock;
+
+        ankerl::unordered_dense::map<lua_State*, std::unique_ptr<ScriptTask>> tasks;
+
+        // Hook events are queued during dispatch and delivered together from an idle source
+        EnumMap<ScriptHook, ScriptHookType> hooks;
+        EnumMap<ScriptHookRetired, ScriptHookType> hooks_retired;
+        std::vector<ScriptHookEvent> hook_queue;
+        wl_event_source* hook_dispatch;
+
+        // Automatic GC is stopped, collection is stepped from the event loop instead
+        struct {
+            wl_event_source* idle;
+            wl_event_source* timer;
+        } gc;
+
+        // Window state is only tracked once a script has asked for it
+        struct {
+            bool enabled;
+            ankerl::unordered_dense::map<Toplevel*, std::shared_ptr<ScriptWindow>> current;
+            sol::object snapshot;
+        } windows;
+
+        ScriptWorkerPool* workers;
+        struct ScriptWorkerPending { sol::protected_function callback; lua_State* task; };
+        ankerl::unordered_dense::map<u64, ScriptWorkerPending> worker_pending;
+
+        // Config changes made inside a batch are applied once when the outermost batch ends
+        u32 batch_depth;
+        ConfigDirty dirty;
+
+        ScriptConfigView config_view;
+
+        // Table last assigned to config.window.rules, rules are compiled and can't be read back
+        sol::object window_rules;
+
+        // Startup scripts are re-run when they, or any file they source, change on disk
+        struct {
+            std::vector<std::filesystem::path> roots;
+            StringMap<bool> files;
+            ankerl::unordered_dense::map<i32, std::filesystem::path> watches;
+            i32 inotify_fd = -1;
+            wl_event_source* source;
+            wl_event_source* timer;
+
+            // Binds, tasks and properties are owned by the config when created
+            // while it loads. A reload only resets what the config owns, anything
+            // set at runtime (e.g. over IPC) is left alone
+            bool loading;
+            bool failed;
+            u32 generation;
+            std::vector<Bind> binds;
+        } reload;
     } script;
 
     sd_bus* dbus;
@@ -187,6 +522,22 @@ struct Server
     std::vector<Client*> clients;
     std::vector<Surface*> surfaces;
     std::vector<Toplevel*> toplevels;
+    u64 next_toplevel_id;
+
+    struct {
+        std::vector<WindowRule> rules;
+        bool match_title;
+    } window_rules;
+
+    // Written at most once per frame, and only when something has changed
+    struct {
+        i32 fd = -1;
+        StateSnapshot* data;
+        bool dirty;
+
+        // Where each toplevel was last written, to check for changes against
+        ankerl::unordered_dense::map<Toplevel*, u32> slots;
+    } snapshot;
 
     struct {
         std::filesystem::path home_dir;
@@ -220,9 +571,30 @@ struct Server
     wlr_seat* seat;
     std::vector<Keyboard*> keyboards;
 
+    struct {
+        xkb_context* context;
+        ankerl::unordered_dense::map<std::string, xkb_keymap*> cache; // Null for rule names that failed to compile
+    } keymaps;
+
+    struct {
+        u32       key_modifiers;
+        u32       buttons_down;
+        u32       modifier_buttons_down;
+        Modifiers modifiers;
+    } input;
+
     std::vector<CommandBind> command_binds;
 
-    wl_event_source* ipc_connection_event_source;
+    struct {
+        wl_event_source* listener;
+        std::vector<MessageConnection*> connections;
+
+        // Union of all subscribed topics, so publishers can skip formatting events nobody wants
+        u32 topics;
+        wl_event_source* metrics_timer;
+
+        u32 max_message_size = 16 * 1024 * 1024;
+    } ipc;
 
     struct {
         wlr_pointer_constraints_v1* pointer_constraints;
@@ -233,6 +605,7 @@ struct Server
         u32             debug_visual_half_extent;
         bool            cursor_is_visible;
         bool            debug_accel_rate = false;
+        bool            latch_pending;
     } pointer;
 
     InteractionMode interaction_mode;
@@ -247,6 +620,16 @@ struct Server
 
     struct {
         Weak<Toplevel> current;
+
+        // Candidates snapshotted on cycle begin, ordered from top of stack down
+        std::vector<FocusCycleCandidate> candidates;
+        usz index;
+        std::optional<vec2> scope;
+
+        // Toplevel directly below the current candidate before it was raised
+        Weak<Toplevel> restore_above;
+        bool restore_at_bottom;
+        bool current_has_family;
     } focus_cycle;
 
     u32 main_modifier;
@@ -294,7 +677,39 @@ struct BorderManager
     };
 
     ankerl::unordered_dense::map<i32, CornerBuffers> corner_cache;
-    ankerl::unordered_dense::map<std::string_view, EnumMap<i32, BorderCorners>> corner_radius_rules;
+};
+
+enum class WindowRulePatternType : u32
+{
+    exact,
+    glob,
+    regex,
+};
+
+struct WindowRulePattern
+{
+    WindowRulePatternType type;
+    std::string pattern;
+    std::regex regex;
+};
+
+struct WindowRule
+{
+    std::optional<WindowRulePattern> app_id;
+    std::optional<WindowRulePattern> title;
+    std::optional<WindowRulePattern> layer_namespace;
+
+    std::optional<bool>                        border;
+    std::optional<EnumMap<i32, BorderCorners>> radius;
+    std::optional<bool>                        close_on_quit;
+};
+
+// Result of evaluating all rules against a surface, cached until its identity changes
+struct WindowRuleResult
+{
+    bool border;
+    EnumMap<i32, BorderCorners> radius;
+    bool close_on_quit = true;
 };
 
 struct Border
@@ -305,19 +720,46 @@ struct Border
     EnumMap<i32, BorderCorners> radius;
 };
 
+enum class IpcTopic : u32
+{
+    focus,
+    map,
+    unmap,
+    output,
+    bind,
+    metrics,
+};
+
 struct MessageConnection
 {
     Server* server;
     wl_event_source* source;
     std::filesystem::path cwd;
     i32 fd;
+
+    // Persistent connections stay open until the client disconnects
+    bool persistent;
+    u32 topics;
+
+    // Incoming frames are reassembled here, outgoing data is queued until the socket accepts it
+    std::string recv_buffer;
+    std::string send_buffer;
+    usz send_offset;
+
+    bool closing;
+    bool dropped;
 };
 
 enum class MessageType : u32
 {
-    Argument = 1,
-    StdOut   = 2,
-    StdErr   = 3,
+    Argument  = 1,
+    StdOut    = 2,
+    StdErr    = 3,
+    Subscribe = 4,
+    Event     = 5,
+    Hello     = 6,
+    Request   = 7,
+    Reply     = 8,
 };
 
 struct MessageHeader
@@ -326,6 +768,30 @@ struct MessageHeader
     u32    size;
 };
 
+// Hello carries a u32 protocol version in each direction. Request payloads are
+// prefixed with a client chosen id. Reply payloads are prefixed with the matching
+// id and a status byte, followed by a JSON object with the id, status and either
+// the returned values or the error message
+
+static constexpr u32 ipc_protocol_version = 3;
+
+// Lower bound for config.ipc.max_message_size, so that a bad value can't lock out every client
+static constexpr u32 ipc_min_message_size = 64 * 1024;
+
+struct MessageRequest
+{
+    u64 id;
+};
+
+enum class MessageReplyStatus : u8
+{
+    ok    = 0,
+    error = 1,
+};
+
+// Size of the Reply prefix, the id is followed directly by the status byte
+static constexpr usz message_reply_prefix_size = sizeof(MessageRequest) + sizeof(MessageReplyStatus);
+
 #define GET_WL_CLIENT_CMDLINE 0
 
 struct Client
@@ -364,6 +830,12 @@ struct Pointer
 
     struct wlr_pointer* wlr_pointer;
 
+    u32 buttons_down;
+    u32 modifier_buttons_down;
+
+    std::shared_ptr<const PointerAccelProfile> accel;
+    std::shared_ptr<const PointerAccelProfile> rel_accel;
+
     vec2 last_abs_pos;
     vec2 accel_remainder = {};
     vec2 rel_accel_remainder = {};
@@ -418,6 +890,7 @@ struct Surface : WeaklyReferenceable
     struct wlr_surface* wlr_surface;
 
     Border border;
+    WindowRuleResult rules;
 
     std::vector<Output*> current_outputs;
 
@@ -474,6 +947,9 @@ struct Toplevel : Surface
         ListenerSet listeners;
     } decoration;
 
+    // Assigned on every map, shared by scripts, IPC and the state snapshot
+    u64 id;
+
     Bounds prev_bounds;
 
     ivec2     anchor;
@@ -564,10 +1040,30 @@ void xwayland_satellite_spawn(Server*, const char* socket, std::function<void(st
 void ipc_server_init(   Server*);
 void ipc_server_cleanup(Server*);
 
-i32 ipc_client_run(std::span<const std::string_view> args);
+i32 ipc_client_run(      std::span<const std::string_view> args);
+i32 ipc_client_request(  std::span<const std::string_view> scripts);
+// With an input fd, replies are printed while waiting on it for the next request
+i32 ipc_client_request_stream(std::istream&, char delimiter, i32 input_fd = -1);
+i32 ipc_client_subscribe(std::span<const std::string_view> topics);
 
 void ipc_send_string(i32 fd, MessageType type, std::string_view str);
 
+void ipc_connection_send(MessageConnection*, MessageType type, std::string_view payload);
+
+// Events are only formatted and sent if some connection is subscribed to the topic
+void ipc_publish_toplevel(Toplevel*, IpcTopic);
+void ipc_publish_output(  Output*, bool added);
+void ipc_publish_bind(    Server*, std::string_view name);
+
+// ---- State Snapshot ---------------------------------------------------------
+
+void state_snapshot_init(      Server*);
+void state_snapshot_mark_dirty(Server*);
+void state_snapshot_check(     Toplevel*);
+void state_snapshot_check(     Output*);
+void state_snapshot_update(    Server*);
+void state_snapshot_cleanup(   Server*);
+
 // ---- Process ----------------------------------------------------------------
 
 void env_set(Server*, std::string_view name, std::optional<std::string_view> value);
@@ -580,6 +1076,49 @@ pid_t spawn(Server*, std::string_view file, std::span<const std::string_view> ar
 void script_system_init(Server*);
 void script_run(        Server*, std::string_view source, const std::filesystem::path& source_dir);
 void script_run_file(   Server*, const std::filesystem::path& script_path);
+// Runs a script and encodes its return values as a JSON array into result, or the error message on failure
+bool script_eval(       Server*, std::string_view source, const std::filesystem::path& source_dir, std::string& result);
+void script_environments_reset(Server*);
+
+void script_async_handle_toplevel_map(Toplevel*);
+void script_async_handle_output_add(  Output*);
+void script_async_cleanup(            Server*);
+
+void script_hook_queue_toplevel(Toplevel*, ScriptHookType);
+void script_hook_queue_output(  Output*, bool added);
+void script_hooks_cleanup(      Server*);
+
+void script_windows_update(Toplevel*);
+void script_windows_remove(Toplevel*);
+
+void script_gc_init(    Server*);
+void script_gc_schedule(Server*);
+void script_gc_cleanup( Server*);
+
+// ---- Script Workers ---------------------------------------------------------
+
+// Values are passed between Lua states in a flat binary encoding
+void        script_value_serialize(  std::string& out, sol::object value);
+sol::object script_value_deserialize(sol::state_view lua, std::string_view& in);
+
+u64  script_worker_submit(  Server*, std::string source, std::string args);
+void script_worker_complete(Server*, u64 id, bool ok, std::string_view payload);
+void script_workers_cleanup(Server*);
+
+void script_config_view_update(Server*);
+
+// ---- Script Reload ----------------------------------------------------------
+
+void script_reload_init(    Server*, std::vector<std::filesystem::path> roots);
+void script_reload_run_root(Server*, const std::filesystem::path& script_path);
+void script_reload_track(   Server*, const std::filesystem::path& script_path);
+void script_reload_schedule(Server*);
+void script_reload(         Server*);
+void script_reload_cleanup( Server*);
+
+void config_mark_dirty( Server*, ConfigDirty);
+void config_batch_begin(Server*);
+void config_batch_end(  Server*);
 
 // ---- Policy -----------------------------------------------------------------
 
@@ -589,12 +1128,21 @@ void      focus_cycle_begin(Server*, wlr_cursor*);
 void      focus_cycle_step( Server*, wlr_cursor*, bool backwards);
 Toplevel* focus_cycle_end(  Server*);
 
+// Begins a focus cycle if one isn't in progress, then steps it
+void focus_cycle_advance(Server*, bool backwards);
+
+void focus_cycle_handle_map(  Toplevel*);
+void focus_cycle_handle_unmap(Toplevel*);
+
 bool input_handle_key(   Server*, const wlr_keyboard_key_event&, xkb_keysym_t sym);
 bool input_handle_button(Server*, const wlr_pointer_button_event&);
 bool input_handle_axis(  Server*, const wlr_pointer_axis_event&);
 
 Modifiers get_modifiers(Server*);
 
+void input_state_set_keyboard(Server*, wlr_keyboard*);
+void input_state_update_pointer(Pointer*);
+
 // ---- Background -------------------------------------------------------------
 
 void background_set(Server*, const char* path);
@@ -610,9 +1158,17 @@ void border_manager_destroy(Server*);
 void borders_create(Surface*);
 void borders_update(Surface*);
 
+// ---- Window Rules -----------------------------------------------------------
+
+std::optional<WindowRulePattern> window_rule_pattern_compile(WindowRulePatternType, std::string_view pattern);
+void window_rules_set(  Server*, std::vector<WindowRule>);
+void window_rules_apply(Surface*);
+
 // ---- Scene ------------------------------------------------------------------
 
 void scene_reconfigure(Server*);
+// Recomputes the output's topmost toplevel from the current stacking order, for restacks made outside of scene_reconfigure
+void scene_update_topmost(Output*);
 
 // ---- Client -----------------------------------------------------------------
 
@@ -623,7 +1179,12 @@ bool client_filter_globals(const wl_client*, const wl_global*, void*);
 
 // ---- Keyboard ---------------------------------------------------------------
 
+xkb_keymap* keymap_get(Server*, const xkb_rule_names&);
+void        keymap_cache_destroy(Server*);
+
 void keyboard_new(Server*, wlr_input_device*);
+void keyboard_update_keymap(Keyboard*);
+void keyboards_update_keymaps(Server*);
 
 void seat_keyboard_focus_change(wl_listener*, void*);
 
@@ -643,6 +1204,8 @@ bool cursor_surface_is_visible(CursorSurface*);
 
 vec2 get_cursor_pos(Server*);
 
+void cursor_latch_position(Server*);
+
 u32 get_num_pointer_buttons_down(Server*);
 
 void process_cursor_resize(Server*);
@@ -660,6 +1223,12 @@ void cursor_frame(          wl_listener*, void*);
 
 void pointer_new(Server*, wlr_input_device*);
 
+std::shared_ptr<const PointerAccelProfile> pointer_accel_profile_compile(std::vector<vec2> points);
+
+void pointer_accel_init(       Server*);
+void pointer_update_accel(     Pointer*);
+void pointers_update_accel_all(Server*);
+
 void pointer_destroy(wl_listener*, void*);
 
 // ---- Pointer.Constraints ----------------------------------------------------
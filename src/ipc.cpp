@@ -4,6 +4,9 @@ static const std::filesystem::path xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
 static const std::filesystem::path ipc_socket_dir  = xdg_runtime_dir / PROGRAM_NAME;
 static const std::string           ipc_socket_env  = ascii_to_upper(PROGRAM_NAME) + "_PROCESS";
 
+static constexpr auto ipc_metrics_interval_ms = 1000;
+static constexpr usz  ipc_receive_chunk_size  = 64 * 1024;
+
 static
 sockaddr_un ipc_socket_path_from_name(std::string_view name)
 {
@@ -56,14 +59,6 @@ std::optional<MessageHeader> ipd_read_message_header(i32 fd, i32 flags)
     return std::nullopt;
 }
 
-static
-bool ipc_read_string(i32 fd, const MessageHeader& header, std::string& out)
-{
-    out.resize(header.size);
-    ssize_t read = recv(fd, out.data(), out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
-    return read == header.size;
-}
-
 void ipc_send_string(i32 fd, MessageType type, std::string_view str)
 {
     MessageHeader header {
@@ -75,25 +70,381 @@ void ipc_send_string(i32 fd, MessageType type, std::string_view str)
 }
 
 static
-i32 ipc_handle_client_read(i32 fd, u32 /* mask */, void* data)
+void ipc_connection_drop(MessageConnection* conn)
+{
+    // Shut the socket down and let the read handler close the connection, so
+    // that connections are never freed from underneath a message being handled
+
+    if (conn->dropped) return;
+    conn->dropped = true;
+    conn->topics = 0;
+    conn->send_buffer.clear();
+    conn->send_offset = 0;
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+static
+void ipc_connection_flush(MessageConnection* conn)
+{
+    while (conn->send_offset < conn->send_buffer.size()) {
+        ssize_t sent = send(conn->fd, conn->send_buffer.data() + conn->send_offset, conn->send_buffer.size() - conn->send_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            ipc_connection_drop(conn);
+            return;
+        }
+        conn->send_offset += sent;
+    }
+
+    if (conn->send_offset == conn->send_buffer.size()) {
+        conn->send_buffer.clear();
+        conn->send_offset = 0;
+    }
+}
+
+static
+void ipc_connection_update_mask(MessageConnection* conn)
+{
+    u32 mask = conn->closing ? 0 : WL_EVENT_READABLE;
+    if (!conn->send_buffer.empty()) mask |= WL_EVENT_WRITABLE;
+    wl_event_source_fd_update(conn->source, mask);
+}
+
+void ipc_connection_send(MessageConnection* conn, MessageType type, std::string_view payload)
+{
+    if (conn->dropped) return;
+
+    MessageHeader header {
+        .type = type,
+        .size = u32(payload.size()),
+    };
+
+    bool was_empty = conn->send_buffer.empty();
+
+    conn->send_buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    conn->send_buffer.append(payload);
+
+    // Writes never block the event loop. Anything the socket won't take now is
+    // queued and flushed when it becomes writable, up to a limit beyond which
+    // the client is considered stuck and disconnected
+
+    ipc_connection_flush(conn);
+
+    if (conn->send_buffer.size() - conn->send_offset > usz(conn->server->ipc.max_message_size) * 4) {
+        ipc_connection_drop(conn);
+        log_warn("IPC connection fd = {} is not keeping up, disconnecting", conn->fd);
+    }
+
+    if (was_empty != conn->send_buffer.empty()) {
+        ipc_connection_update_mask(conn);
+    }
+}
+
+static
+void ipc_update_topics(Server* server)
+{
+    server->ipc.topics = 0;
+    for (auto* conn : server->ipc.connections) {
+        server->ipc.topics |= conn->topics;
+    }
+}
+
+static
+void ipc_connection_close(MessageConnection* conn)
+{
+    Server* server = conn->server;
+
+    log_trace("closing connection, fd = {}", conn->fd);
+
+    if (conn->persistent) {
+        std::erase(server->ipc.connections, conn);
+        ipc_update_topics(server);
+    }
+
+    close(conn->fd);
+    wl_event_source_remove(conn->source);
+    delete conn;
+}
+
+static
+void ipc_connection_make_persistent(MessageConnection* conn)
+{
+    if (!conn->persistent) {
+        conn->persistent = true;
+        conn->server->ipc.connections.emplace_back(conn);
+    }
+}
+
+static
+void ipc_connection_subscribe(MessageConnection* conn, std::string_view topics)
+{
+    Server* server = conn->server;
+
+    ipc_connection_make_persistent(conn);
+
+    usz b = 0;
+    for (;;) {
+        usz n = topics.find(' ', b);
+        auto name = topics.substr(b, n - b);
+        if (!name.empty()) {
+            if (auto value = magic_enum::enum_cast<IpcTopic>(name)) {
+                conn->topics |= 1u << std::to_underlying(*value);
+            } else {
+                log_error("Unknown IPC topic: {}", name);
+            }
+        }
+
+        if (n == std::string_view::npos) break;
+        b = n + 1;
+    }
+
+    server->ipc.topics |= conn->topics;
+
+    if (conn->topics & (1u << std::to_underlying(IpcTopic::metrics))) {
+        wl_event_source_timer_update(server->ipc.metrics_timer, ipc_metrics_interval_ms);
+    }
+}
+
+static
+void ipc_handle_request(MessageConnection* conn, std::string_view payload)
+{
+    if (payload.size() < sizeof(MessageRequest)) {
+        log_warn("Truncated IPC request ({} bytes)", payload.size());
+        return;
+    }
+
+    MessageRequest request;
+    std::memcpy(&request, payload.data(), sizeof(request));
+    payload.remove_prefix(sizeof(request));
+
+    std::string result;
+    bool ok = script_eval(conn->server, payload, conn->cwd, result);
+
+    auto status = ok ? MessageReplyStatus::ok : MessageReplyStatus::error;
+
+    std::string reply;
+    reply.append(reinterpret_cast<const char*>(&request), sizeof(request));
+    reply.append(reinterpret_cast<const char*>(&status), sizeof(status));
+    std::format_to(std::back_inserter(reply), "{{\"id\":{},\"ok\":{},", request.id, ok);
+    if (ok) {
+        reply += "\"result\":";
+        reply += result;
+    } else {
+        reply += "\"error\":";
+        json_append_string(reply, result);
+    }
+    reply += '}';
+
+    ipc_connection_send(conn, MessageType::Reply, reply);
+}
+
+static
+void ipc_handle_message(MessageConnection* conn, MessageType type, std::string_view payload)
+{
+    switch (type) {
+        case MessageType::Argument:
+            script_run(conn->server, payload, conn->cwd);
+            break;
+        case MessageType::Subscribe:
+            ipc_connection_subscribe(conn, payload);
+            break;
+        case MessageType::Hello:
+            ipc_connection_make_persistent(conn);
+            ipc_connection_send(conn, MessageType::Hello, std::string_view(reinterpret_cast<const char*>(&ipc_protocol_version), sizeof(ipc_protocol_version)));
+            break;
+        case MessageType::Request:
+            ipc_connection_make_persistent(conn);
+            ipc_handle_request(conn, payload);
+            break;
+        default:
+            log_warn("Unexpected IPC message type: {}", std::to_underlying(type));
+    }
+}
+
+static
+bool ipc_connection_dispatch(MessageConnection* conn)
+{
+    // Handle every complete frame in the receive buffer, leaving any partial
+    // frame in place until the rest of it arrives. Returns whether any were handled
+
+    auto& buffer = conn->recv_buffer;
+    u32 max_size = conn->server->ipc.max_message_size;
+
+    log_set_message_sink(conn);
+    defer { log_set_message_sink(nullptr); };
+
+    usz offset = 0;
+    while (!conn->dropped && buffer.size() - offset >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        std::memcpy(&header, buffer.data() + offset, sizeof(header));
+
+        if (header.size > max_size) {
+            log_error("IPC message of {} bytes exceeds maximum size of {} bytes", header.size, max_size);
+            ipc_connection_flush(conn);
+            ipc_connection_drop(conn);
+            break;
+        }
+
+        if (buffer.size() - offset - sizeof(header) < header.size) break;
+
+        auto payload = std::string_view(buffer).substr(offset + sizeof(header), header.size);
+        offset += sizeof(header) + header.size;
+
+        ipc_handle_message(conn, header.type, payload);
+    }
+
+    buffer.erase(0, offset);
+
+    return offset > 0;
+}
+
+static
+i32 ipc_handle_client_read(i32 fd, u32 mask, void* data)
 {
     MessageConnection* conn = static_cast<MessageConnection*>(data);
 
-    {
-        log_set_message_sink(conn);
-        defer { log_set_message_sink(nullptr); };
+    if (mask & WL_EVENT_WRITABLE) {
+        ipc_connection_flush(conn);
+    }
 
-        std::string arg;
-        while (auto header = ipd_read_message_header(conn->fd, MSG_DONTWAIT)) {
-            if (header->type == MessageType::Argument && ipc_read_string(fd, *header, arg)) {
-                script_run(conn->server, arg, conn->cwd);
+    bool eof = mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR);
+    bool handled = false;
+
+    if ((mask & WL_EVENT_READABLE) && !conn->closing) {
+        // Frames are reassembled across as many readable events as they need
+
+        for (;;) {
+            usz size = conn->recv_buffer.size();
+            conn->recv_buffer.resize(size + ipc_receive_chunk_size);
+            ssize_t count = recv(fd, conn->recv_buffer.data() + size, ipc_receive_chunk_size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            conn->recv_buffer.resize(size + std::max<ssize_t>(count, 0));
+
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (count <= 0) {
+                eof = true;
+                break;
             }
+
+            handled |= ipc_connection_dispatch(conn);
+            if (conn->dropped) break;
         }
     }
 
-    close(fd);
-    wl_event_source_remove(conn->source);
-    delete conn;
+    // Connections are finished once the client shuts down its end, after which
+    // any queued output is flushed before the connection is closed.
+    //
+    // Clients that never negotiate (with Hello or Subscribe) predate this, they
+    // send their messages and wait for the connection to close without shutting
+    // down their end. Those are finished once everything they sent is handled
+
+    if (eof || (!conn->persistent && handled && conn->recv_buffer.empty())) {
+        conn->closing = true;
+    }
+
+    if (conn->dropped || (conn->closing && conn->send_buffer.empty())) {
+        ipc_connection_close(conn);
+        return 0;
+    }
+
+    ipc_connection_update_mask(conn);
+
+    return 0;
+}
+
+static
+void ipc_publish(Server* server, IpcTopic topic, std::string_view payload)
+{
+    // Subscribers that fall too far behind are dropped while sending
+    u32 mask = 1u << std::to_underlying(topic);
+
+    for (auto* conn : server->ipc.connections) {
+        if (conn->topics & mask) {
+            ipc_connection_send(conn, MessageType::Event, payload);
+        }
+    }
+
+    ipc_update_topics(server);
+}
+
+static
+bool ipc_has_subscribers(Server* server, IpcTopic topic)
+{
+    return server->ipc.topics & (1u << std::to_underlying(topic));
+}
+
+static
+void ipc_event_begin(std::string& out, IpcTopic topic)
+{
+    out += "{\"topic\":";
+    json_append_string(out, magic_enum::enum_name(topic));
+}
+
+void ipc_publish_toplevel(Toplevel* toplevel, IpcTopic topic)
+{
+    Server* server = toplevel->server;
+    if (!ipc_has_subscribers(server, topic)) return;
+
+    auto* xdg_toplevel = toplevel->xdg_toplevel();
+
+    std::string event;
+    ipc_event_begin(event, topic);
+    event += std::format(",\"id\":{}", toplevel->id);
+    event += ",\"app_id\":";
+    json_append_string(event, xdg_toplevel->app_id ?: "");
+    event += ",\"title\":";
+    json_append_string(event, xdg_toplevel->title ?: "");
+    event += "}";
+
+    ipc_publish(server, topic, event);
+}
+
+void ipc_publish_output(Output* output, bool added)
+{
+    Server* server = output->server;
+    if (!ipc_has_subscribers(server, IpcTopic::output)) return;
+
+    std::string event;
+    ipc_event_begin(event, IpcTopic::output);
+    event += ",\"name\":";
+    json_append_string(event, output->wlr_output->name);
+    event += std::format(",\"added\":{}}}", added);
+
+    ipc_publish(server, IpcTopic::output, event);
+}
+
+void ipc_publish_bind(Server* server, std::string_view name)
+{
+    if (!ipc_has_subscribers(server, IpcTopic::bind)) return;
+
+    std::string event;
+    ipc_event_begin(event, IpcTopic::bind);
+    event += ",\"bind\":";
+    json_append_string(event, name);
+    event += "}";
+
+    ipc_publish(server, IpcTopic::bind, event);
+}
+
+static
+i32 ipc_handle_metrics_timer(void* data)
+{
+    Server* server = static_cast<Server*>(data);
+    if (!ipc_has_subscribers(server, IpcTopic::metrics)) return 0;
+
+    std::string event;
+    ipc_event_begin(event, IpcTopic::metrics);
+    event += std::format(",\"toplevels\":{},\"surfaces\":{},\"outputs\":{},\"clients\":{},\"script_heap\":{},\"script_tasks\":{},\"subscribers\":{}}}",
+        server->toplevels.size(),
+        server->surfaces.size(),
+        server->outputs.size(),
+        server->clients.size(),
+        server->script.heap.total,
+        server->script.tasks.size(),
+        server->ipc.connections.size());
+
+    ipc_publish(server, IpcTopic::metrics, event);
+
+    wl_event_source_timer_update(server->ipc.metrics_timer, ipc_metrics_interval_ms);
 
     return 0;
 }
@@ -145,36 +496,250 @@ void ipc_server_init(Server* server)
     if (fd >= 0) {
         log_info("Opened IPC socket, setting {}={}", ipc_socket_env, name);
         env_set(server, ipc_socket_env, name);
-        server->ipc_connection_event_source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), fd, WL_EVENT_READABLE, ipc_handle_socket_accept, server);
+        server->ipc.listener = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), fd, WL_EVENT_READABLE, ipc_handle_socket_accept, server);
     }
+
+    server->ipc.metrics_timer = wl_event_loop_add_timer(wl_display_get_event_loop(server->display), ipc_handle_metrics_timer, server);
 }
 
 void ipc_server_cleanup(Server* server)
 {
-    if (server->ipc_connection_event_source)
-        wl_event_source_remove(server->ipc_connection_event_source);
+    while (!server->ipc.connections.empty()) {
+        ipc_connection_close(server->ipc.connections.back());
+    }
+
+    if (server->ipc.metrics_timer)
+        wl_event_source_remove(server->ipc.metrics_timer);
+
+    if (server->ipc.listener)
+        wl_event_source_remove(server->ipc.listener);
 }
 
-i32 ipc_client_run(std::span<const std::string_view> args)
+static
+i32 ipc_client_connect()
 {
     const char* socket_name = getenv(ipc_socket_env.c_str());
+    if (!socket_name) {
+        std::cerr << std::format("{} is not set, not running under " PROGRAM_NAME "?\n", ipc_socket_env);
+        return -1;
+    }
     auto addr = ipc_socket_path_from_name(socket_name);
 
-    i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    i32 fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
         perror("connect");
-        return EXIT_FAILURE;
+        close(fd);
+        return -1;
     }
 
+    return fd;
+}
+
+static
+bool ipc_client_read_string(i32 fd, const MessageHeader& header, std::string& out)
+{
+    out.resize(header.size);
+    return !header.size || recv(fd, out.data(), out.size(), MSG_WAITALL) == ssize_t(header.size);
+}
+
+i32 ipc_client_run(std::span<const std::string_view> args)
+{
+    i32 fd = ipc_client_connect();
+    if (fd < 0) return EXIT_FAILURE;
+
+    // Negotiate first, so the compositor waits for the end of our messages
+    ipc_send_string(fd, MessageType::Hello, std::string_view(reinterpret_cast<const char*>(&ipc_protocol_version), sizeof(ipc_protocol_version)));
+
     for (auto arg : args) {
         ipc_send_string(fd, MessageType::Argument, arg);
     }
 
+    // Signal that all arguments have been sent, so the compositor doesn't have
+    // to guess where the end of the messages is for large payloads
+    shutdown(fd, SHUT_WR);
+
+    std::string msg;
+    while (auto header = ipd_read_message_header(fd, MSG_WAITALL)) {
+        if (!ipc_client_read_string(fd, *header, msg)) break;
+
+        switch (header->type) {
+            case MessageType::StdOut: std::cout << msg; break;
+            case MessageType::StdErr: std::cerr << msg; break;
+            default:
+        }
+    }
+
+    close(fd);
+
+    return EXIT_SUCCESS;
+}
+
+static
+i32 ipc_client_request_each(i32 input_fd, auto&& next)
+{
+    // Requests are pipelined, keeping up to a fixed number in flight so that
+    // neither side's socket buffers can fill up with nobody reading them.
+    // Replies arrive in request order, tagged with the request id.
+    //
+    // With an input fd (a possibly slow or interactive producer), replies are
+    // also read while waiting for the next request, so they show up as soon as
+    // they arrive instead of when the input ends
+
+    static constexpr u64 max_in_flight = 256;
+
+    i32 fd = ipc_client_connect();
+    if (fd < 0) return EXIT_FAILURE;
+    defer { close(fd); };
+
+    ipc_send_string(fd, MessageType::Hello, std::string_view(reinterpret_cast<const char*>(&ipc_protocol_version), sizeof(ipc_protocol_version)));
+
+    u64 in_flight = 0;
+    bool failed = false;
+
     std::string msg;
-    while (auto header = ipd_read_message_header(fd, 0)) {
+    auto read_frame = [&] {
+        auto header = ipd_read_message_header(fd, MSG_WAITALL);
+        if (!header || !ipc_client_read_string(fd, *header, msg)) {
+            std::cerr << "Connection closed with requests outstanding\n";
+            return false;
+        }
+
+        switch (header->type) {
+            case MessageType::Hello: {
+                u32 version = 0;
+                std::memcpy(&version, msg.data(), std::min(msg.size(), sizeof(version)));
+                if (version != ipc_protocol_version) {
+                    std::cerr << std::format("Protocol version mismatch, client {} compositor {}\n", ipc_protocol_version, version);
+                    return false;
+                }
+                break;
+            }
+            case MessageType::Reply: {
+                if (msg.size() < message_reply_prefix_size) {
+                    std::cerr << "Truncated reply\n";
+                    return false;
+                }
+                in_flight--;
+                MessageReplyStatus status;
+                std::memcpy(&status, msg.data() + sizeof(MessageRequest), sizeof(status));
+                if (status != MessageReplyStatus::ok) failed = true;
+                std::cout << std::string_view(msg).substr(message_reply_prefix_size) << '\n';
+                break;
+            }
+            case MessageType::StdOut: std::cout << msg; break;
+            case MessageType::StdErr: std::cerr << msg; break;
+            default:
+        }
+
+        return true;
+    };
+
+    auto read_reply = [&] {
+        u64 expected = in_flight - 1;
+        while (in_flight > expected) {
+            if (!read_frame()) return false;
+        }
+        return true;
+    };
+
+    auto wait_for_input = [&] {
+        while (in_flight) {
+            std::cout.flush();
+
+            pollfd fds[] {
+                { .fd = input_fd, .events = POLLIN },
+                { .fd = fd,       .events = POLLIN },
+            };
+            if (poll(fds, std::size(fds), -1) < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+
+            if (fds[1].revents) {
+                if (!read_frame()) return false;
+            } else if (fds[0].revents) {
+                break;
+            }
+        }
+        return true;
+    };
+
+    u64 id;
+    std::string payload;
+    std::string_view script;
+    for (;;) {
+        if (input_fd >= 0 && !wait_for_input()) return EXIT_FAILURE;
+        if (!next(id, script)) break;
+
+        if (in_flight == max_in_flight && !read_reply()) return EXIT_FAILURE;
+
+        MessageRequest request { .id = id };
+        payload.assign(reinterpret_cast<const char*>(&request), sizeof(request));
+        payload += script;
+        ipc_send_string(fd, MessageType::Request, payload);
+        in_flight++;
+    }
+
+    while (in_flight) {
+        if (!read_frame()) return EXIT_FAILURE;
+    }
+
+    std::cout.flush();
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+i32 ipc_client_request(std::span<const std::string_view> scripts)
+{
+    usz index = 0;
+    return ipc_client_request_each(-1, [&](u64& id, std::string_view& script) {
+        if (index == scripts.size()) return false;
+        script = scripts[index++];
+        id = index;
+        return true;
+    });
+}
+
+i32 ipc_client_request_stream(std::istream& in, char delimiter, i32 input_fd)
+{
+    // Each non-empty entry is a separate request, with its line number as id
+
+    u64 line = 0;
+    std::string entry;
+    return ipc_client_request_each(input_fd, [&](u64& id, std::string_view& script) {
+        while (std::getline(in, entry, delimiter)) {
+            line++;
+            if (entry.find_first_not_of(" \t\r\n") == std::string::npos) continue;
+            id = line;
+            script = entry;
+            return true;
+        }
+        return false;
+    });
+}
+
+i32 ipc_client_subscribe(std::span<const std::string_view> topics)
+{
+    i32 fd = ipc_client_connect();
+    if (fd < 0) return EXIT_FAILURE;
+
+    std::string request;
+    for (auto topic : topics) {
+        if (!request.empty()) request += ' ';
+        request += topic;
+    }
+    ipc_send_string(fd, MessageType::Subscribe, request);
+
+    // Events are printed one per line until the compositor closes the connection
+
+    std::string msg;
+    while (auto header = ipd_read_message_header(fd, MSG_WAITALL)) {
+        if (!ipc_client_read_string(fd, *header, msg)) break;
+
         switch (header->type) {
-            case MessageType::StdOut: if (ipc_read_string(fd, *header, msg)) std::cout << msg; break;
-            case MessageType::StdErr: if (ipc_read_string(fd, *header, msg)) std::cerr << msg; break;
+            case MessageType::Event:  std::cout << msg << std::endl; break;
+            case MessageType::StdOut: std::cout << msg; break;
+            case MessageType::StdErr: std::cerr << msg; break;
             default:
         }
     }
@@ -20,6 +20,11 @@ void log_set_message_sink(struct MessageConnection* conn)
     log_state.ipc_sink = conn;
 }
 
+MessageConnection* log_get_message_sink()
+{
+    return log_state.ipc_sink;
+}
+
 LogLevel get_log_level()
 {
     return log_state.log_level;
@@ -45,7 +50,7 @@ void log(LogLevel level, std::string_view message)
 
     std::cout << std::vformat(log_state.is_tty ? fmt.vt : fmt.plain, std::make_format_args(message));
     if (log_state.ipc_sink) {
-        ipc_send_string(log_state.ipc_sink->fd, MessageType::StdErr,
+        ipc_connection_send(log_state.ipc_sink, MessageType::StdErr,
             std::vformat(fmt.vt, std::make_format_args(message)));
     }
 }
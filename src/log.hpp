@@ -13,6 +13,7 @@ enum class LogLevel : u32
 };
 
 void log_set_message_sink(struct MessageConnection*);
+struct MessageConnection* log_get_message_sink();
 LogLevel get_log_level();
 void init_log(LogLevel, wlr_log_importance, const char* log_file);
 void      log(LogLevel, std::string_view message);
@@ -22,9 +22,9 @@ void server_request_quit(Server* server, bool force)
         ankerl::unordered_dense::set<Client*> keep_clients;
         for (auto* toplevel : server->toplevels) {
 
-            // We want firefox to open all windows on relaunch
-            // TODO: This should be configurable on a per-client basis
-            if (toplevel->app_id() == "firefox") continue;
+            // Some clients (e.g. firefox) restore all of their windows on relaunch
+            // only if they are not closed individually, this is set by window rules
+            if (!toplevel->rules.close_on_quit) continue;
 
             keep_clients.emplace(Client::from(server, wl_resource_get_client(toplevel->xdg_toplevel()->resource)));
             log_info("Requesting toplevel close: {}", surface_to_string(toplevel));
@@ -192,6 +192,8 @@ void init(Server* server, const startup_options& options)
 
     server->pointer.relative_pointer_manager = wlr_relative_pointer_manager_v1_create(server->display);
 
+    pointer_accel_init(server);
+
     server->cursor = wlr_cursor_create();
     wlr_cursor_attach_output_layout(server->cursor, server->output_layout);
 
@@ -234,6 +236,7 @@ void init(Server* server, const startup_options& options)
     // Borders
 
     border_manager_create(server);
+    script_config_view_update(server);
 }
 
 void run(Server* server, const startup_options& options)
@@ -250,15 +253,27 @@ void run(Server* server, const startup_options& options)
 
     ipc_server_init(server);
 
+    state_snapshot_init(server);
+
     // Startup command
 
     for (auto& script_path : options.startup_scripts) {
         std::visit(overload_set {
-            [&](const std::filesystem::path& path) { script_run_file(server, path); },
+            [&](const std::filesystem::path& path) { script_reload_run_root(server, path); },
             [&](std::string_view source)           { script_run(server, source, std::filesystem::current_path()); }
         }, script_path);
     }
 
+    {
+        std::vector<std::filesystem::path> roots;
+        for (auto& script_path : options.startup_scripts) {
+            if (auto* path = std::get_if<std::filesystem::path>(&script_path)) {
+                roots.emplace_back(*path);
+            }
+        }
+        script_reload_init(server, std::move(roots));
+    }
+
     // Run
 
     log_info("Running Wayland compositor on WAYLAND_DISPLAY={}", socket);
@@ -284,12 +299,19 @@ void cleanup(Server* server)
     server->listeners.clear();
 
     ipc_server_cleanup(server);
+    script_async_cleanup(server);
+    script_hooks_cleanup(server);
+    script_workers_cleanup(server);
+    script_gc_cleanup(server);
+    script_reload_cleanup(server);
+    state_snapshot_cleanup(server);
 
     wlr_xcursor_manager_destroy(server->cursor_manager);
     wlr_cursor_destroy(server->cursor);
     wlr_allocator_destroy(server->allocator);
     wlr_renderer_destroy(server->renderer);
     wlr_backend_destroy(server->backend);
+    keymap_cache_destroy(server);
     wl_display_destroy(server->display);
     wlr_scene_node_destroy(&server->scene->tree.node);
 
@@ -309,12 +331,30 @@ Usage: {0} [options]...
 
   E.g. {0} --log-file {0}.log -s resources/startup.lua
 
-Usage: {0} msg [script]...
+Usage: {0} msg [--json] [script]...
+       {0} msg [-0] --stdin
+       {0} msg [-0] --batch [file]
 
   Send a number of Lua fragments to the enclosing compositor to be executed.
 
+    --json                Print one JSON reply per fragment with its return
+                          values, or the error it raised.
+    --stdin               Stream fragments from stdin, one per line, over a
+                          single connection. Replies are printed as with
+                          --json, tagged with the line number as id.
+    --batch    [file]     As --stdin, reading fragments from a file.
+    -0, --null            Fragments are separated by NUL instead of newline.
+
   E.g. {0} msg 'debug.output.new()'
 
+Usage: {0} subscribe [topic]...
+
+  Keep a connection open to the enclosing compositor and print events
+  for the given topics as they happen, one JSON object per line.
+  Topics: focus, map, unmap, output, bind, metrics
+
+  E.g. {0} subscribe focus output
+
 )";
 
 i32 main(i32 argc, char* argv[])
@@ -323,9 +363,32 @@ i32 main(i32 argc, char* argv[])
     CommandParser cmd{args};
 
     if (cmd.match("msg")) {
+        char delimiter = '\n';
+        if (cmd.match("-0") || cmd.match("--null")) {
+            delimiter = '\0';
+        }
+        if (cmd.match("--json")) {
+            return ipc_client_request(cmd.peek_rest());
+        }
+        if (cmd.match("--stdin")) {
+            return ipc_client_request_stream(std::cin, delimiter, STDIN_FILENO);
+        }
+        if (cmd.match("--batch")) {
+            std::filesystem::path path = cmd.get_string();
+            std::ifstream file(path);
+            if (!file) {
+                std::cerr << std::format("Failed to open batch file [{}]\n", path.c_str());
+                return EXIT_FAILURE;
+            }
+            return ipc_client_request_stream(file, delimiter);
+        }
         return ipc_client_run(cmd.peek_rest());
     }
 
+    if (cmd.match("subscribe")) {
+        return ipc_client_subscribe(cmd.peek_rest());
+    }
+
     startup_options options = {};
 
     auto print_usage = [&] {
@@ -91,11 +91,21 @@ void output_frame(wl_listener* listener, void*)
 
     wlr_scene_output* scene_output = output->scene_output();
 
+    // Apply any cursor motion that arrived since the frame was scheduled.
+    // The hardware cursor plane is moved by wlr_cursor directly, if nothing else
+    // is damaged this results in a cursor-only commit
+
+    cursor_latch_position(output->server);
+
+    state_snapshot_update(output->server);
+
     wlr_scene_output_commit(scene_output, nullptr);
 
     timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
     wlr_scene_output_send_frame_done(scene_output, &now);
+
+    script_gc_schedule(output->server);
 }
 
 void output_request_state(wl_listener* listener, void* data)
@@ -129,12 +139,17 @@ void output_destroy(wl_listener* listener, void*)
     output->wlr_output->data = nullptr;
 
     for (Surface* surface : output->server->surfaces) {
-        std::erase(surface->current_outputs, output);
+        if (std::erase(surface->current_outputs, output)) {
+            if (Toplevel* toplevel = Toplevel::from(surface)) script_windows_update(toplevel);
+        }
     }
 
     std::erase(output->server->outputs, output);
 
     output->server->script.on_output_add_or_remove(output, false);
+    script_hook_queue_output(output, false);
+    ipc_publish_output(output, false);
+    state_snapshot_mark_dirty(output->server);
 
     scene_reconfigure(output->server);
 
@@ -206,6 +221,11 @@ void output_new(wl_listener* listener, void* data)
     wlr_output_layout_add_auto(server->output_layout, output->wlr_output);
 
     server->script.on_output_add_or_remove(output, true);
+
+    script_async_handle_output_add(output);
+    script_hook_queue_output(output, true);
+    ipc_publish_output(output, true);
+    state_snapshot_mark_dirty(output->server);
 }
 
 void output_layout_change(wl_listener* listener, void*)
@@ -261,6 +281,8 @@ void output_reconfigure(Output* output)
     for (zwlr_layer_shell_v1_layer layer : output->layers.enum_values) {
         output_reconfigure_layer(output, layer);
     }
+
+    state_snapshot_check(output);
 }
 
 void outputs_reconfigure_all(Server* server)
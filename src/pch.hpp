@@ -17,6 +17,10 @@
 #include <source_location>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <regex>
+#include <atomic>
 
 #include <csignal>
 
@@ -29,7 +33,14 @@
 #include <stdarg.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fnmatch.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <drm/drm_fourcc.h>
 
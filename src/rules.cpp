@@ -0,0 +1,91 @@
+#include "core.hpp"
+
+std::optional<WindowRulePattern> window_rule_pattern_compile(WindowRulePatternType type, std::string_view pattern)
+{
+    WindowRulePattern compiled {
+        .type = type,
+        .pattern = std::string(pattern),
+    };
+
+    if (type == WindowRulePatternType::regex) {
+        try {
+            compiled.regex = std::regex(compiled.pattern, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            log_error("Invalid window rule regex [{}]: {}", pattern, e.what());
+            return std::nullopt;
+        }
+    }
+
+    return compiled;
+}
+
+static
+bool window_rule_pattern_matches(const WindowRulePattern& pattern, std::string_view value)
+{
+    switch (pattern.type) {
+        case WindowRulePatternType::exact:
+            return value == pattern.pattern;
+        case WindowRulePatternType::glob:
+            return fnmatch(pattern.pattern.c_str(), std::string(value).c_str(), 0) == 0;
+        case WindowRulePatternType::regex:
+            return std::regex_match(value.begin(), value.end(), pattern.regex);
+    }
+
+    return false;
+}
+
+static
+bool window_rule_matches(const WindowRule& rule, Surface* surface)
+{
+    if (Toplevel* toplevel = Toplevel::from(surface)) {
+        if (rule.layer_namespace) return false;
+        if (rule.app_id && !window_rule_pattern_matches(*rule.app_id, toplevel->app_id())) return false;
+        if (rule.title  && !window_rule_pattern_matches(*rule.title,  toplevel->xdg_toplevel()->title ?: "")) return false;
+        return true;
+    }
+
+    if (LayerSurface* layer_surface = LayerSurface::from(surface)) {
+        if (rule.app_id || rule.title) return false;
+        if (rule.layer_namespace && !window_rule_pattern_matches(*rule.layer_namespace, layer_surface->wlr_layer_surface()->namespace_ ?: "")) return false;
+        return true;
+    }
+
+    return false;
+}
+
+void window_rules_apply(Surface* surface)
+{
+    // Rules are applied in order, later matching rules override earlier ones
+
+    WindowRuleResult result {
+        .border = surface->role == SurfaceRole::toplevel,
+    };
+    for (auto& e : result.radius._data) e = BorderUnset;
+
+    for (const WindowRule& rule : surface->server->window_rules.rules) {
+        if (!window_rule_matches(rule, surface)) continue;
+
+        if (rule.border)        result.border        = *rule.border;
+        if (rule.radius)        result.radius        = *rule.radius;
+        if (rule.close_on_quit) result.close_on_quit = *rule.close_on_quit;
+    }
+
+    surface->rules = result;
+}
+
+void window_rules_set(Server* server, std::vector<WindowRule> rules)
+{
+    server->window_rules.rules = std::move(rules);
+
+    // Title changes are frequent, only re-evaluate on them if any rule cares
+
+    server->window_rules.match_title = std::ranges::any_of(server->window_rules.rules, [](const WindowRule& rule) {
+        return rule.title.has_value();
+    });
+
+    for (Surface* surface : server->surfaces) {
+        if (surface->role == SurfaceRole::toplevel || surface->role == SurfaceRole::layer_surface) {
+            window_rules_apply(surface);
+        }
+    }
+}
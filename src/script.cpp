@@ -8,53 +8,556 @@ template<typename ...Args>
     throw std::runtime_error(message);
 }
 
-struct MetatableBuilder
+// -----------------------------------------------------------------------------
+
+struct ScriptObject
+{
+    // Config objects are userdata with all field dispatch resolved from a single
+    // hash lookup, with values converted to and from Lua directly in C++
+
+    struct Property
+    {
+        std::function<void(sol::object)> set;
+        std::function<sol::object(sol::state_view)> get;
+        bool (*accepts)(const sol::object&);
+
+        // Value from before the config first assigned this property, restored
+        // when a reload of the config no longer assigns it
+        sol::object initial;
+        u32 generation;
+    };
+
+    StringMap<Property>    properties;
+    StringMap<sol::object> members;
+};
+
+template<typename Fn>
+struct script_setter_traits : script_setter_traits<decltype(&Fn::operator())> {};
+
+template<typename C, typename R, typename Arg>
+struct script_setter_traits<R(C::*)(Arg) const>
 {
-    sol::table metatable;
-    sol::table table;
+    using arg_type = std::remove_cvref_t<Arg>;
+};
 
-    static constexpr const char* properties_key = "__properties";
+struct ScriptObjectBuilder
+{
+    sol::state& lua;
+    sol::object handle;
+    ScriptObject* object;
+
+    ScriptObjectBuilder(sol::state& _lua, auto&& slot)
+        : lua(_lua)
+        , handle(sol::make_object(lua, ScriptObject{}))
+        , object(&handle.as<ScriptObject&>())
+    {
+        slot = handle;
+    }
 
-    MetatableBuilder(sol::state& lua, auto&& slot): metatable(lua.create_table()), table(lua.create_table())
+    ScriptObjectBuilder(ScriptObjectBuilder& parent, const char* name)
+        : lua(parent.lua)
+        , handle(sol::make_object(lua, ScriptObject{}))
+        , object(&handle.as<ScriptObject&>())
     {
-        metatable["__newindex"] = [](sol::table table, const char* field, sol::object value) {
-            auto prop = table[properties_key][field];
-            if (prop.is<sol::table>()) {
-                prop["set"](value);
-            } else {
-                script_error("no property with name: {}", field);
-            }
+        parent.add_member(name, handle);
+    }
+
+    void add_member(const char* name, sol::object value)
+    {
+        object->members[name] = std::move(value);
+    }
+
+    sol::table add_table(const char* name)
+    {
+        sol::table table = lua.create_table();
+        add_member(name, table);
+        return table;
+    }
+
+    void add_property(const char* name, auto set, auto get)
+    {
+        using Arg = typename script_setter_traits<decltype(set)>::arg_type;
+
+        object->properties[name] = ScriptObject::Property {
+            .set = [name = std::string(name), set = std::move(set)](sol::object value) {
+                if (!value.is<Arg>()) {
+                    script_error("Invalid value for property {}, got: {}", name, magic_enum::enum_name(value.get_type()));
+                }
+                set(value.as<Arg>());
+            },
+            .get = [get = std::move(get)](sol::state_view lua) -> sol::object {
+                return sol::make_object(lua, get());
+            },
+            .accepts = [](const sol::object& value) {
+                return value.is<Arg>();
+            },
         };
-        metatable["__index"] = [](sol::table table, const char* field) -> sol::object {
-            auto prop = table[properties_key][field];
-            if (prop.is<sol::table>()) {
-                return prop["get"]();
-            } else {
+    }
+};
+
+static
+bool script_object_equal(const sol::object& a, const sol::object& b)
+{
+    if (a.get_type() != b.get_type()) return false;
+
+    switch (a.get_type()) {
+        case sol::type::lua_nil:
+            return true;
+        case sol::type::boolean:
+        case sol::type::number:
+        case sol::type::string:
+        case sol::type::function: {
+            lua_State* L = b.lua_state();
+            a.push(L);
+            b.push(L);
+            bool equal = lua_rawequal(L, -1, -2);
+            lua_pop(L, 2);
+            return equal;
+        }
+        default:
+            return false;
+    }
+}
+
+// Assigns a converted config value, returning false if it was unchanged
+static
+bool script_config_assign(auto& dst, auto&& value)
+{
+    if (dst == value) return false;
+    dst = std::forward<decltype(value)>(value);
+    return true;
+}
+
+static
+void script_object_register(Server* server)
+{
+    server->script.lua.new_usertype<ScriptObject>("ScriptObject",
+        sol::no_constructor,
+        sol::meta_function::index, [](sol::this_state ts, ScriptObject& self, std::string_view field) -> sol::object {
+            if (auto prop = self.properties.find(field); prop != self.properties.end()) {
+                return prop->second.get(sol::state_view(ts));
+            }
+            if (auto member = self.members.find(field); member != self.members.end()) {
+                return member->second;
+            }
+            script_error("no property with name: {}", field);
+        },
+        sol::meta_function::new_index, [server](ScriptObject& self, std::string_view field, sol::object value) {
+            auto prop = self.properties.find(field);
+            if (prop == self.properties.end()) {
                 script_error("no property with name: {}", field);
             }
-        };
 
-        table[properties_key] = lua.create_table();
+            auto& reload = server->script.reload;
+            if (!reload.loading) {
+                prop->second.generation = 0;
+                prop->second.initial = sol::nil;
+            } else if (prop->second.generation) {
+                prop->second.generation = reload.generation;
+            } else if (auto initial = prop->second.get(value.lua_state()); prop->second.accepts(initial)) {
+                // Only tracked if the current value can be handed back to the setter
+                prop->second.initial = std::move(initial);
+                prop->second.generation = reload.generation;
+            }
+
+            if (script_object_equal(prop->second.get(value.lua_state()), value)) {
+                // Re-running a config (e.g. on reload) re-assigns every property,
+                // only values that actually changed are applied
+                return;
+            }
+            prop->second.set(std::move(value));
+            script_config_view_update(server);
+        });
+}
 
-        slot = table;
+// -----------------------------------------------------------------------------
+
+static constexpr const char* script_config_view_cdef = R"(
+    struct zen_config_view {
+        int32_t border_width;
+        int32_t border_radius;
+        float   border_color_focused[4];
+        float   border_color_unfocused[4];
+
+        uint32_t grid_width;
+        uint32_t grid_height;
+        int32_t  grid_leeway_horizontal;
+        int32_t  grid_leeway_vertical;
+        int32_t  grid_pad_inner;
+        int32_t  grid_pad_left;
+        int32_t  grid_pad_top;
+        int32_t  grid_pad_right;
+        int32_t  grid_pad_bottom;
+
+        float focus_cycle_opacity;
+    };
+)";
+
+void script_config_view_update(Server* server)
+{
+    auto& view   = server->script.config_view;
+    auto& layout = server->config.layout;
+
+    if (auto* m = server->border_manager) {
+        view.border_width  = m->border_width;
+        view.border_radius = m->border_radius;
+        std::memcpy(view.border_color_focused,   glm::value_ptr(m->border_color_focused),   sizeof(view.border_color_focused));
+        std::memcpy(view.border_color_unfocused, glm::value_ptr(m->border_color_unfocused), sizeof(view.border_color_unfocused));
     }
 
-    ~MetatableBuilder()
+    view.grid_width             = layout.zone_horizontal_zones;
+    view.grid_height            = layout.zone_vertical_zones;
+    view.grid_leeway_horizontal = layout.zone_selection_leeway.x;
+    view.grid_leeway_vertical   = layout.zone_selection_leeway.y;
+    view.grid_pad_inner         = layout.zone_internal_padding;
+    view.grid_pad_left          = layout.zone_external_padding.left;
+    view.grid_pad_top           = layout.zone_external_padding.top;
+    view.grid_pad_right         = layout.zone_external_padding.right;
+    view.grid_pad_bottom        = layout.zone_external_padding.bottom;
+
+    view.focus_cycle_opacity = layout.focus_cycle_unselected_opacity;
+}
+
+namespace {
+    // Every invocation of script code runs under a budget, so that a runaway script
+    // is aborted with an error long before the watchdog takes the compositor down.
+    // Note that the hook cannot preempt time spent inside native functions
+
+    constexpr i32  script_budget_hook_interval = 1000;
+    constexpr u64  script_budget_instructions  = 5'000'000;
+    constexpr auto script_budget_time          = 100ms;
+
+    // Automatic GC is stopped (see script_gc_step), so a script producing a lot of
+    // garbage within a single invocation is stepped from the hook instead
+    constexpr usz  script_budget_gc_slack      = 64 * 1024 * 1024;
+    constexpr i32  script_budget_gc_step_kb    = 256;
+
+    struct {
+        u32 depth;
+        u64 instructions;
+        std::chrono::steady_clock::time_point start;
+        bool exceeded;
+    } script_budget;
+
+    // The sampling profiler shares the budget hook. Each sample attributes the time
+    // since the previous sample to the current call stack, folded into a single
+    // string per stack so that the output can be fed straight into flamegraph tools.
+    // Samples only span time within one invocation, and the time spent taking
+    // them is neither attributed to a stack nor charged to the script's budget
+
+    struct {
+        bool active;
+        i32 interval = script_budget_hook_interval;
+        std::chrono::steady_clock::time_point last_sample;
+        ankerl::unordered_dense::map<std::string, std::chrono::nanoseconds> stacks;
+        std::vector<std::string> frames;
+        std::string folded;
+    } script_profile;
+
+    i32 script_hook_interval()
     {
-        table[sol::metatable_key] = metatable;
+        return script_profile.active ? script_profile.interval : script_budget_hook_interval;
     }
 
-    void add_property(const char* name, auto set, auto get)
+    // Returns the time at which the sample was finished
+    std::chrono::steady_clock::time_point script_profile_sample(lua_State* L, std::chrono::steady_clock::time_point now)
     {
-        auto props = table[properties_key][name].get_or_create<sol::table>();
-        props["set"] = set;
-        props["get"] = get;
+        auto& profile = script_profile;
+
+        profile.frames.clear();
+        lua_Debug ar;
+        for (i32 level = 0; lua_getstack(L, level, &ar); ++level) {
+            lua_getinfo(L, "Sln", &ar);
+            auto& frame = profile.frames.emplace_back();
+            if (ar.currentline >= 0) {
+                frame = std::format("{} ({}:{})", ar.name ? ar.name : ar.what, ar.short_src, ar.currentline);
+            } else {
+                frame = std::format("{} ({})", ar.name ? ar.name : ar.what, ar.short_src);
+            }
+            std::ranges::replace(frame, ';', ':');
+        }
+
+        profile.folded.clear();
+        for (auto frame = profile.frames.rbegin(); frame != profile.frames.rend(); ++frame) {
+            if (!profile.folded.empty()) profile.folded += ';';
+            profile.folded += *frame;
+        }
+
+        profile.stacks[profile.folded] += now - profile.last_sample;
+        profile.last_sample = std::chrono::steady_clock::now();
+        return profile.last_sample;
     }
-};
+
+    void script_budget_hook(lua_State* L, lua_Debug*)
+    {
+        auto& budget = script_budget;
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (script_profile.active) {
+            auto sampled = script_profile_sample(L, now);
+            budget.start += sampled - now;
+            now = sampled;
+        }
+
+        budget.instructions += script_hook_interval();
+        auto elapsed = now - budget.start;
+
+        void* ud;
+        lua_getallocf(L, &ud);
+        auto* heap = static_cast<ScriptHeap*>(ud);
+        if (heap->limit && (heap->limit_collect_pending
+                || (heap->total > heap->limit - heap->limit / 8 && heap->total > heap->gc_baseline + heap->limit / 16))) {
+            // Close to (or past) the heap limit, find out how much of it is live
+            lua_gc(L, LUA_GCCOLLECT, 0);
+            lua_gc(L, LUA_GCSTOP, 0);
+            heap->gc_baseline = heap->total;
+            heap->limit_collect_pending = false;
+            heap->limit_reached = heap->total > heap->limit;
+        } else if (heap->total > heap->gc_baseline + script_budget_gc_slack) {
+            if (lua_gc(L, LUA_GCSTEP, script_budget_gc_step_kb)) {
+                heap->gc_baseline = heap->total;
+            }
+            lua_gc(L, LUA_GCSTOP, 0);
+        }
+
+        if (budget.exceeded
+                || budget.instructions > script_budget_instructions
+                || elapsed > script_budget_time) {
+            budget.exceeded = true;
+            luaL_error(L, "script exceeded budget (%llu instructions in %s)",
+                (unsigned long long)budget.instructions, duration_to_string(elapsed).c_str());
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+static
+usz script_heap_size_class(usz size)
+{
+    return size <= ScriptHeap::small_size_max ? (size + ScriptHeap::small_size_step - 1) / ScriptHeap::small_size_step : 0;
+}
+
+static
+void* script_heap_pool_alloc(ScriptHeap* heap, usz size_class)
+{
+    void*& free_list = heap->free_lists[size_class - 1];
+    if (free_list) {
+        void* ptr = free_list;
+        free_list = *static_cast<void**>(ptr);
+        return ptr;
+    }
+
+    usz size = size_class * ScriptHeap::small_size_step;
+    if (heap->block_remaining < size) {
+        // Any tail left in the previous block is abandoned
+        heap->blocks.emplace_back(new std::byte[ScriptHeap::block_size]);
+        heap->block_cursor = heap->blocks.back().get();
+        heap->block_remaining = ScriptHeap::block_size;
+    }
+
+    void* ptr = heap->block_cursor;
+    heap->block_cursor += size;
+    heap->block_remaining -= size;
+    return ptr;
+}
+
+static
+void script_heap_pool_free(ScriptHeap* heap, void* ptr, usz size_class)
+{
+    void*& free_list = heap->free_lists[size_class - 1];
+    *static_cast<void**>(ptr) = free_list;
+    free_list = ptr;
+}
+
+void* script_heap_alloc(void* ud, void* ptr, usz osize, usz nsize)
+{
+    auto* heap = static_cast<ScriptHeap*>(ud);
+
+    // When allocating a new object, osize holds the object type instead
+    if (!ptr) osize = 0;
+
+    usz old_class = script_heap_size_class(osize);
+    usz new_class = script_heap_size_class(nsize);
+
+    if (nsize == 0) {
+        if (ptr) {
+            if (old_class) script_heap_pool_free(heap, ptr, old_class);
+            else           std::free(ptr);
+            heap->total -= osize;
+            if (heap->total <= heap->limit) heap->limit_reached = false;
+        }
+        return nullptr;
+    }
+
+    // The limit is only enforced while a script is running, where the resulting
+    // memory error is caught, and never for shrinking allocations which must not fail.
+    // Uncollected garbage counts towards the total, so a bounded overshoot is allowed
+    // until the budget hook has run a full collection
+
+    if (nsize > osize && heap->limit && script_budget.depth) {
+        usz next = heap->total + nsize - osize;
+        if (next > heap->limit) {
+            if (heap->limit_reached || next > heap->limit + heap->limit / 4) {
+                return nullptr;
+            }
+            heap->limit_collect_pending = true;
+        }
+    }
+
+    void* res;
+    if (ptr && old_class && old_class == new_class) {
+        res = ptr;
+    } else if (ptr && !old_class && !new_class) {
+        res = std::realloc(ptr, nsize);
+        if (!res) return nullptr;
+    } else {
+        res = new_class ? script_heap_pool_alloc(heap, new_class) : std::malloc(nsize);
+        if (!res) return nullptr;
+        if (ptr) {
+            std::memcpy(res, ptr, std::min(osize, nsize));
+            if (old_class) script_heap_pool_free(heap, ptr, old_class);
+            else           std::free(ptr);
+        }
+    }
+
+    heap->total += nsize - osize;
+    heap->peak = std::max(heap->peak, heap->total);
+
+    if (nsize > osize) {
+        auto& source = heap->sources[heap->current_source];
+        source.bytes += nsize - osize;
+        source.allocations++;
+    }
+
+    return res;
+}
+
+static
+u32 script_heap_source_get(ScriptHeap& heap, std::string_view name)
+{
+    if (auto index = heap.source_index.find(name); index != heap.source_index.end()) {
+        return index->second;
+    }
+
+    u32 index = u32(heap.sources.size());
+    heap.sources.emplace_back(ScriptHeapSource { .name = std::string(name) });
+    heap.source_index.emplace(std::string(name), index);
+    return index;
+}
+
+// -----------------------------------------------------------------------------
+
+// Garbage collection is kept out of binds, hooks and other latency sensitive script
+// invocations. Automatic collection is stopped, and the collector is instead stepped
+// from an idle source after frames are committed and scripts have run, with a small
+// time budget per step. A timer keeps collection going when nothing is drawing
+
+namespace {
+    constexpr auto script_gc_step_budget   = 1ms;
+    constexpr i32  script_gc_step_kb       = 64;
+    constexpr auto script_gc_timer_ms      = 1000;
+    constexpr auto script_gc_behind_ms     = 10;
+}
+
+static
+void script_gc_step(Server* server)
+{
+    lua_State* L = server->script.lua.lua_state();
+    auto& heap = server->script.heap;
+
+    if (script_budget.depth) return;
+
+    // Nothing can have become garbage without the heap growing
+
+    if (heap.total <= heap.gc_baseline) return;
+
+    bool finished = false;
+    auto deadline = std::chrono::steady_clock::now() + script_gc_step_budget;
+    do {
+        if (lua_gc(L, LUA_GCSTEP, script_gc_step_kb)) {
+            heap.gc_baseline = heap.total;
+            finished = true;
+            break;
+        }
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    // Stepping re-arms the automatic threshold
+    lua_gc(L, LUA_GCSTOP, 0);
+
+    // Never collect past the step budget in one go. If the cycle didn't finish,
+    // come back shortly rather than waiting for the next frame or timer tick
+    if (!finished) {
+        wl_event_source_timer_update(server->script.gc.timer, script_gc_behind_ms);
+    }
+}
+
+void script_gc_schedule(Server* server)
+{
+    auto& gc = server->script.gc;
+    if (gc.idle) return;
+
+    gc.idle = wl_event_loop_add_idle(wl_display_get_event_loop(server->display), [](void* data) {
+        Server* server = static_cast<Server*>(data);
+        server->script.gc.idle = nullptr;
+        script_gc_step(server);
+    }, server);
+}
+
+void script_gc_init(Server* server)
+{
+    auto& gc = server->script.gc;
+    auto& heap = server->script.heap;
+
+    lua_gc(server->script.lua.lua_state(), LUA_GCSTOP, 0);
+    heap.gc_baseline = heap.total;
+
+    gc.timer = wl_event_loop_add_timer(wl_display_get_event_loop(server->display), [](void* data) {
+        Server* server = static_cast<Server*>(data);
+        script_gc_schedule(server);
+        wl_event_source_timer_update(server->script.gc.timer, script_gc_timer_ms);
+        return 0;
+    }, server);
+    wl_event_source_timer_update(gc.timer, script_gc_timer_ms);
+}
+
+void script_gc_cleanup(Server* server)
+{
+    auto& gc = server->script.gc;
+    if (gc.idle)  wl_event_source_remove(gc.idle);
+    if (gc.timer) wl_event_source_remove(gc.timer);
+    gc = {};
+}
+
+// -----------------------------------------------------------------------------
 
 static
-bool script_invoke_safe(auto&& function)
+bool script_invoke_safe(Server* server, std::string_view source, auto&& function)
 {
+    lua_State* L = server->script.lua.lua_state();
+
+    // Nested invocations (e.g. `source`) share the budget of the outermost call
+
+    if (!script_budget.depth++) {
+        script_budget.instructions = 0;
+        script_budget.start = std::chrono::steady_clock::now();
+        script_budget.exceeded = false;
+        script_profile.last_sample = script_budget.start;
+        lua_sethook(L, script_budget_hook, LUA_MASKCOUNT, script_hook_interval());
+    }
+    defer {
+        if (!--script_budget.depth) {
+            lua_sethook(L, nullptr, 0, 0);
+            script_gc_schedule(server);
+        }
+    };
+
+    auto& heap = server->script.heap;
+    u32 prev_source = heap.current_source;
+    heap.current_source = script_heap_source_get(heap, source);
+    defer { heap.current_source = prev_source; };
+
     try {
         auto res = function();
         if (!res.valid()) {
@@ -62,7 +565,14 @@ bool script_invoke_safe(auto&& function)
         }
         return true;
     } catch (const sol::error& e) {
-        log_error("Script error: {}", e.what());
+        log_error("Script error in {}: {}", source, e.what());
+        if (heap.limit && heap.total > heap.limit) {
+            // Likely failed to allocate, try to get back under the limit
+            lua_gc(L, LUA_GCCOLLECT, 0);
+            lua_gc(L, LUA_GCSTOP, 0);
+            heap.gc_baseline = heap.total;
+            heap.limit_reached = heap.total > heap.limit;
+        }
         return false;
     }
 }
@@ -119,142 +629,1040 @@ fvec4 script_object_to_color(sol::object obj)
     return color;
 }
 
+// Color getters return the same {r, g, b, a} table form that the setters accept
 static
-void script_env_set_globals(Server* server)
+auto script_color_to_object(fvec4 color)
 {
-    auto& lua = server->script.lua;
+    return sol::as_table(std::vector<f32> { color.r, color.g, color.b, color.a });
+}
 
-    lua.set_function("spawn", [server](sol::variadic_args varargs) {
-        std::vector<std::string> args;
-        for (auto arg : varargs) {
-            args.emplace_back(arg.get<std::string>());
+static
+void config_apply(Server* server, ConfigDirty dirty)
+{
+    log_debug("Applying config changes: {}", magic_enum::enum_flags_name(dirty));
+
+    if (dirty >= ConfigDirty::background) {
+        for (auto* output : server->outputs) {
+            wlr_scene_rect_set_color(output->background_color, color_to_wlroots(server->config.layout.background_color));
         }
-        std::vector<std::string_view> argview(args.begin(), args.end());
-        spawn(server, argview.front(), argview);
-    });
+    }
 
-    lua.set_function("xwayland", [server](const char* requested_socket, sol::protected_function callback) {
-        xwayland_satellite_spawn(server, requested_socket, [callback = std::move(callback)](std::string_view socket) {
-            script_invoke_safe([&] { return callback(socket); });
-        });
-    });
+    if (dirty >= ConfigDirty::keymaps) keyboards_update_keymaps(server);
+    if (dirty >= ConfigDirty::pointer) pointers_update_accel_all(server);
 
-    sol::table config = lua["config"].get_or_create<sol::table>();
+    if (dirty >= ConfigDirty::workarea) outputs_reconfigure_all(server);
 
-    // Output
+    // Opacity only differs from the default while a focus cycle is in progress
+    bool update_opacity = dirty >= ConfigDirty::opacity && server->interaction_mode == InteractionMode::focus_cycle;
 
-    {
-        MetatableBuilder output(lua, config["output"]);
+    if (update_opacity || dirty >= ConfigDirty::borders) {
+        for (Toplevel* toplevel : server->toplevels) {
+            if (update_opacity) toplevel_update_opacity(toplevel);
+            borders_update(toplevel);
+        }
+    }
+}
 
-        output.add_property("on_add_or_remove", [server](sol::protected_function fn) {
-            log_info("Setting output layout add/remove listener");
-            server->script.on_output_add_or_remove = [fn = std::move(fn)](Output* output, bool added) {
-                log_info("Output added/removed");
-                script_invoke_safe([&] {
-                    return output
-                        ? fn(output->wlr_output->name, added)
-                        : fn();
-                });
-            };
-            server->script.on_output_add_or_remove(nullptr, true);
-        }, [] { return sol::nil; });
+void config_mark_dirty(Server* server, ConfigDirty dirty)
+{
+    if (server->script.batch_depth) {
+        server->script.dirty |= dirty;
+    } else {
+        config_apply(server, dirty);
     }
+}
 
-    // Focus cycle
+void config_batch_begin(Server* server)
+{
+    server->script.batch_depth++;
+}
 
-    {
-        MetatableBuilder focus_cycle(lua, config["focus_cycle"]);
+void config_batch_end(Server* server)
+{
+    if (--server->script.batch_depth) return;
 
-        focus_cycle.add_property("opacity", [server](f32 opacity) {
-            server->config.layout.focus_cycle_unselected_opacity = opacity;
-            log_info("Setting focus_cycle.opacity = {}", opacity);
-            scene_reconfigure(server);
-        }, [server] { return server->config.layout.focus_cycle_unselected_opacity; });
+    ConfigDirty dirty = std::exchange(server->script.dirty, {});
+    if (bool(dirty)) {
+        config_apply(server, dirty);
     }
+}
 
-    // Layout
+// -----------------------------------------------------------------------------
 
-    {
-        {
-            MetatableBuilder background(lua, config["background"]);
+// Coroutines started with `async` yield from their wait primitives and are resumed
+// from event loop sources and compositor events, so scripts can wait without
+// blocking the compositor
 
-            background.add_property("color", [server](sol::object color) {
-                server->config.layout.background_color = script_object_to_color(color);
-                log_info("Setting background.color = {}", glm::to_string(server->config.layout.background_color));
-                for (auto* output : server->outputs) {
-                    wlr_scene_rect_set_color(output->background_color, color_to_wlroots(server->config.layout.background_color));
-                }
-            }, [] { return sol::nil; /* TODO */ });
+static
+void script_task_clear_wait(ScriptTask* task)
+{
+    if (task->source) {
+        wl_event_source_remove(task->source);
+        task->source = nullptr;
+    }
+    if (task->pidfd >= 0) {
+        close(task->pidfd);
+        task->pidfd = -1;
+    }
+    task->wait = ScriptTaskWait::none;
+    task->resume_value = sol::nil;
+}
 
-            background.add_property("image", [server](const char* path) {
-                log_info("Setting background.image = {}", path);
-                background_set(server, path);
-            }, [] { return sol::nil; });
-        }
+static
+void script_task_resume(ScriptTask* task, sol::object value = sol::nil)
+{
+    Server* server = task->server;
+    lua_State* thread = task->thread.thread_state();
 
-        {
-            MetatableBuilder border(lua, config["border"]);
+    script_task_clear_wait(task);
 
-            border.add_property("width", [server](i32 width) {
-                log_info("Setting border width: {}", width);
-                server->border_manager->border_width = width;
-                scene_reconfigure(server);
-            }, [server] { return server->border_manager->border_width; });
+    bool ok = script_invoke_safe(server, "async", [&] { return task->coroutine(value); });
 
-            border.add_property("radius", [server](i32 radius) {
-                log_info("Setting border radius: {}", radius);
-                server->border_manager->border_radius = radius;
-                scene_reconfigure(server);
-            }, [server] { return server->border_manager->border_radius; });
+    // The task may have been removed by a cleanup while it was running
+    auto iter = server->script.tasks.find(thread);
+    if (iter == server->script.tasks.end()) return;
 
-            {
-                MetatableBuilder color(lua, border.table["color"]);
+    if (!ok || lua_status(thread) != LUA_YIELD) {
+        if (!ok) log_error("Async task failed, dropping");
+        script_task_clear_wait(task);
+        server->script.tasks.erase(iter);
+        return;
+    }
 
-                color.add_property("focused", [server](sol::object color) {
-                    server->border_manager->border_color_focused = script_object_to_color(color);
-                    log_info("Setting border.color.focused = {}", glm::to_string(server->border_manager->border_color_focused));
-                    scene_reconfigure(server);
-                }, [] { return sol::nil; /* TODO */ });
+    if (task->wait == ScriptTaskWait::none) {
+        log_error("Async task yielded without waiting on anything, dropping");
+        server->script.tasks.erase(iter);
+    }
+}
 
-                color.add_property("default", [server](sol::object color) {
-                    server->border_manager->border_color_unfocused = script_object_to_color(color);
-                    log_info("Setting border.color.default = {}", glm::to_string(server->border_manager->border_color_unfocused));
-                    scene_reconfigure(server);
-                }, [] { return sol::nil; /* TODO */ });
-            }
-        }
+static
+void script_task_resume_later(ScriptTask* task, sol::object value)
+{
+    task->wait = ScriptTaskWait::resume;
+    task->resume_value = std::move(value);
+    task->source = wl_event_loop_add_idle(wl_display_get_event_loop(task->server->display), [](void* data) {
+        ScriptTask* task = static_cast<ScriptTask*>(data);
+        // Idle sources are removed by the event loop once dispatched
+        task->source = nullptr;
+        script_task_resume(task, task->resume_value);
+    }, task);
+}
 
-        // Grid
+static
+ScriptTask* script_task_get_current(Server* server, lua_State* L, const char* name)
+{
+    auto task = server->script.tasks.find(L);
+    if (task == server->script.tasks.end()) {
+        script_error("{} can only be called from inside an async function", name);
+    }
+    return task->second.get();
+}
 
-        {
-            MetatableBuilder grid(lua, config["grid"]);
+static
+bool script_task_window_matches(ScriptTask* task, Toplevel* toplevel)
+{
+    if (!task->app_id.empty() && toplevel->app_id() != task->app_id) return false;
+    if (!task->title.empty()) {
+        const char* title = toplevel->xdg_toplevel()->title;
+        if (!title || task->title != title) return false;
+    }
+    return true;
+}
 
-            {
-                MetatableBuilder leeway(lua, grid.table["leeway"]);
+static
+sol::object script_toplevel_to_object(Server* server, Toplevel* toplevel)
+{
+    const char* title = toplevel->xdg_toplevel()->title;
+    return server->script.lua.create_table_with(
+        "app_id", toplevel->app_id(),
+        "title", title ? title : "");
+}
 
-                leeway.add_property("horizontal", [server](i32 amount) {
-                    log_info("Setting grid.leeway.horizontal = {}", amount);
-                    server->config.layout.zone_selection_leeway.x = amount;
-                }, [server] { return server->config.layout.zone_selection_leeway.x; });
+static
+void script_tasks_resume_if(Server* server, ScriptTaskWait wait, auto&& predicate, auto&& value)
+{
+    // Resuming may start or finish other tasks, so snapshot the candidates first
 
-                leeway.add_property("vertical", [server](i32 amount) {
-                    log_info("Setting grid.leeway.vertical = {}", amount);
-                    server->config.layout.zone_selection_leeway.y = amount;
-                }, [server] { return server->config.layout.zone_selection_leeway.y; });
-            }
+    std::vector<lua_State*> waiting;
+    for (auto& [thread, task] : server->script.tasks) {
+        if (task->wait == wait && predicate(task.get())) {
+            waiting.emplace_back(thread);
+        }
+    }
+
+    for (lua_State* thread : waiting) {
+        auto task = server->script.tasks.find(thread);
+        if (task != server->script.tasks.end() && task->second->wait == wait) {
+            script_task_resume(task->second.get(), value());
+        }
+    }
+}
+
+void script_async_handle_toplevel_map(Toplevel* toplevel)
+{
+    Server* server = toplevel->server;
+    if (server->script.tasks.empty()) return;
+
+    script_tasks_resume_if(server, ScriptTaskWait::window,
+        [&](ScriptTask* task) { return script_task_window_matches(task, toplevel); },
+        [&] { return script_toplevel_to_object(server, toplevel); });
+}
+
+void script_async_handle_output_add(Output* output)
+{
+    Server* server = output->server;
+    if (server->script.tasks.empty()) return;
+
+    std::string_view name = output->wlr_output->name;
+    script_tasks_resume_if(server, ScriptTaskWait::output,
+        [&](ScriptTask* task) { return task->output == name; },
+        [&] { return sol::make_object(server->script.lua, name); });
+}
+
+static
+void script_async_cancel_config(Server* server)
+{
+    auto& tasks = server->script.tasks;
+
+    usz cancelled = 0;
+    for (auto iter = tasks.begin(); iter != tasks.end();) {
+        if (iter->second->config) {
+            script_task_clear_wait(iter->second.get());
+            iter = tasks.erase(iter);
+            cancelled++;
+        } else {
+            ++iter;
+        }
+    }
+    if (cancelled) log_debug("Cancelled {} async task(s) started by the config", cancelled);
+}
+
+void script_async_cleanup(Server* server)
+{
+    for (auto& [_, task] : server->script.tasks) {
+        script_task_clear_wait(task.get());
+    }
+    server->script.tasks.clear();
+}
+
+static
+void script_async_register(Server* server)
+{
+    auto& lua = server->script.lua;
+
+    lua.set_function("async", [server](sol::this_state ts, sol::protected_function fn) {
+        auto parent = server->script.tasks.find(ts.lua_state());
+
+        auto task = std::make_unique<ScriptTask>();
+        task->server = server;
+        task->config = server->script.reload.loading || (parent != server->script.tasks.end() && parent->second->config);
+        task->thread = sol::thread::create(server->script.lua.lua_state());
+        task->coroutine = sol::coroutine(task->thread.thread_state(), fn);
+
+        ScriptTask* ptr = task.get();
+        server->script.tasks.emplace(task->thread.thread_state(), std::move(task));
+        script_task_resume(ptr);
+    });
+
+    lua.set_function("sleep", sol::yielding([server](sol::this_state ts, u32 ms) {
+        ScriptTask* task = script_task_get_current(server, ts, "sleep");
+
+        task->wait = ScriptTaskWait::sleep;
+        task->source = wl_event_loop_add_timer(wl_display_get_event_loop(server->display), [](void* data) {
+            script_task_resume(static_cast<ScriptTask*>(data));
+            return 0;
+        }, task);
+        wl_event_source_timer_update(task->source, std::max(1u, ms));
+    }));
+
+    lua.set_function("wait_for_window", sol::yielding([server](sol::this_state ts, sol::table filter) {
+        ScriptTask* task = script_task_get_current(server, ts, "wait_for_window");
+
+        task->app_id = filter.get_or<std::string>("app_id", "");
+        task->title  = filter.get_or<std::string>("title",  "");
+
+        for (Toplevel* toplevel : server->toplevels) {
+            if (toplevel->wlr_surface->mapped && script_task_window_matches(task, toplevel)) {
+                script_task_resume_later(task, script_toplevel_to_object(server, toplevel));
+                return;
+            }
+        }
+
+        task->wait = ScriptTaskWait::window;
+    }));
+
+    lua.set_function("wait_for_output", sol::yielding([server](sol::this_state ts, std::string name) {
+        ScriptTask* task = script_task_get_current(server, ts, "wait_for_output");
+
+        for (Output* output : server->outputs) {
+            if (output->wlr_output->name == name) {
+                script_task_resume_later(task, sol::make_object(server->script.lua, name));
+                return;
+            }
+        }
+
+        task->output = std::move(name);
+        task->wait = ScriptTaskWait::output;
+    }));
+
+    lua.set_function("wait_for_process", sol::yielding([server](sol::this_state ts, pid_t pid) {
+        ScriptTask* task = script_task_get_current(server, ts, "wait_for_process");
+
+        i32 pidfd = i32(syscall(SYS_pidfd_open, pid, 0));
+        if (pidfd < 0) {
+            // Already gone
+            script_task_resume_later(task, sol::nil);
+            return;
+        }
+
+        task->wait = ScriptTaskWait::process;
+        task->pidfd = pidfd;
+        task->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), pidfd, WL_EVENT_READABLE, [](i32, u32, void* data) {
+            script_task_resume(static_cast<ScriptTask*>(data));
+            return 0;
+        }, task);
+    }));
+}
+
+// -----------------------------------------------------------------------------
+
+// The window snapshot is maintained incrementally from compositor events. Each
+// change replaces only the affected window, and the snapshot object handed to Lua
+// is rebuilt lazily on the next query, so repeated queries return the same userdata
+
+static
+bool script_window_matches(const ScriptWindow& window, Toplevel* toplevel)
+{
+    const char* title = toplevel->xdg_toplevel()->title;
+
+    wlr_box bounds = surface_get_bounds(toplevel);
+    if (!wlr_box_equal(&window.bounds, &bounds)) return false;
+    if (window.focused != (get_focused_surface(toplevel->server) == toplevel)) return false;
+    if (window.app_id != toplevel->app_id()) return false;
+    if (window.title != std::string_view(title ?: "")) return false;
+    if (window.outputs.size() != toplevel->current_outputs.size()) return false;
+    for (usz i = 0; i < window.outputs.size(); ++i) {
+        if (window.outputs[i] != toplevel->current_outputs[i]->wlr_output->name) return false;
+    }
+
+    return true;
+}
+
+void script_windows_update(Toplevel* toplevel)
+{
+    Server* server = toplevel->server;
+    auto& windows = server->script.windows;
+
+    if (!windows.enabled) return;
+    if (!toplevel->wlr_surface->mapped) return;
+
+    auto& entry = windows.current[toplevel];
+    if (entry && script_window_matches(*entry, toplevel)) return;
+
+    const char* title = toplevel->xdg_toplevel()->title;
+    auto window = std::make_shared<ScriptWindow>(ScriptWindow {
+        .id = toplevel->id,
+        .app_id = std::string(toplevel->app_id()),
+        .title = title ?: "",
+        .bounds = surface_get_bounds(toplevel),
+        .focused = get_focused_surface(server) == toplevel,
+    });
+    for (Output* output : toplevel->current_outputs) {
+        window->outputs.emplace_back(output->wlr_output->name);
+    }
+
+    entry = std::move(window);
+    windows.snapshot = sol::nil;
+}
+
+void script_windows_remove(Toplevel* toplevel)
+{
+    auto& windows = toplevel->server->script.windows;
+    if (windows.current.erase(toplevel)) {
+        windows.snapshot = sol::nil;
+    }
+}
+
+static
+sol::object script_windows_get(Server* server)
+{
+    auto& windows = server->script.windows;
+
+    if (!windows.enabled) {
+        windows.enabled = true;
+        for (Toplevel* toplevel : server->toplevels) {
+            script_windows_update(toplevel);
+        }
+    }
+
+    if (windows.snapshot.valid()) return windows.snapshot;
+
+    auto snapshot = std::make_shared<ScriptWindowSnapshot>();
+    for (auto& [_, window] : windows.current) {
+        snapshot->windows.emplace_back(window);
+    }
+    std::ranges::sort(snapshot->windows, {}, &ScriptWindow::id);
+
+    for (u32 i = 0; i < snapshot->windows.size(); ++i) {
+        snapshot->objects.emplace_back(sol::make_object(server->script.lua, snapshot->windows[i]));
+
+        auto& window = *snapshot->windows[i];
+        snapshot->by_app_id[window.app_id].emplace_back(i);
+        for (auto& output : window.outputs) {
+            snapshot->by_output[output].emplace_back(i);
+        }
+    }
+
+    windows.snapshot = sol::make_object(server->script.lua, std::move(snapshot));
+    return windows.snapshot;
+}
+
+static
+sol::table script_window_list(sol::this_state ts, const ScriptWindowSnapshot& snapshot, const StringMap<std::vector<u32>>& index, std::string_view key)
+{
+    // Each caller gets its own list, so that modifying it can't affect anyone
+    // else. Only the table is new, the windows in it are shared and read-only
+
+    sol::state_view lua(ts);
+    auto indices = index.find(key);
+    sol::table list = lua.create_table(indices != index.end() ? indices->second.size() : 0, 0);
+    if (indices != index.end()) {
+        for (u32 i : indices->second) {
+            list.add(snapshot.objects[i]);
+        }
+    }
+    return list;
+}
+
+static
+void script_windows_register(Server* server)
+{
+    auto& lua = server->script.lua;
+
+    lua.new_usertype<ScriptWindow>("Window",
+        sol::no_constructor,
+        "id",      sol::readonly(&ScriptWindow::id),
+        "app_id",  sol::readonly(&ScriptWindow::app_id),
+        "title",   sol::readonly(&ScriptWindow::title),
+        "focused", sol::readonly(&ScriptWindow::focused),
+        "x",       sol::property([](const ScriptWindow& w) { return w.bounds.x;      }),
+        "y",       sol::property([](const ScriptWindow& w) { return w.bounds.y;      }),
+        "width",   sol::property([](const ScriptWindow& w) { return w.bounds.width;  }),
+        "height",  sol::property([](const ScriptWindow& w) { return w.bounds.height; }),
+        "outputs", sol::property([](const ScriptWindow& w) { return sol::as_table(w.outputs); }));
+
+    lua.new_usertype<ScriptWindowSnapshot>("WindowSnapshot",
+        sol::no_constructor,
+        sol::meta_function::length, [](const ScriptWindowSnapshot& s) { return s.windows.size(); },
+        sol::meta_function::index, [](sol::this_state ts, const ScriptWindowSnapshot& s, sol::object key) -> sol::object {
+            if (!key.is<i32>()) return sol::nil;
+            i32 i = key.as<i32>();
+            if (i < 1 || usz(i) > s.windows.size()) return sol::nil;
+            return s.objects[i - 1];
+        },
+        "with_app_id", [](sol::this_state ts, const ScriptWindowSnapshot& s, std::string_view app_id) {
+            return script_window_list(ts, s, s.by_app_id, app_id);
+        },
+        "on_output", [](sol::this_state ts, const ScriptWindowSnapshot& s, std::string_view output) {
+            return script_window_list(ts, s, s.by_output, output);
+        },
+        "focused", [](const ScriptWindowSnapshot& s) -> sol::object {
+            for (u32 i = 0; i < s.windows.size(); ++i) {
+                if (s.windows[i]->focused) return s.objects[i];
+            }
+            return sol::nil;
+        });
+
+    lua.set_function("windows", [server] {
+        return script_windows_get(server);
+    });
+}
+
+// -----------------------------------------------------------------------------
+
+void script_worker_complete(Server* server, u64 id, bool ok, std::string_view payload)
+{
+    auto pending = server->script.worker_pending.find(id);
+    if (pending == server->script.worker_pending.end()) return;
+    auto [callback, thread] = std::move(pending->second);
+    server->script.worker_pending.erase(pending);
+
+    sol::object value = sol::nil;
+    if (ok) {
+        try {
+            value = script_value_deserialize(server->script.lua, payload);
+        } catch (const std::exception& e) {
+            log_error("Failed to read worker result: {}", e.what());
+        }
+    } else {
+        log_error("Worker job failed: {}", payload);
+    }
+
+    if (callback.valid()) {
+        script_invoke_safe(server, "worker", [&] { return callback(value); });
+    }
+
+    if (thread) {
+        auto task = server->script.tasks.find(thread);
+        if (task != server->script.tasks.end() && task->second->wait == ScriptTaskWait::worker) {
+            script_task_resume(task->second.get(), value);
+        }
+    }
+}
+
+static
+void script_workers_register(Server* server)
+{
+    auto& lua = server->script.lua;
+
+    sol::table worker = lua["worker"].get_or_create<sol::table>();
+
+    // Run `source` on a worker state, it receives `arg` as `...` and its first
+    // return value is passed back. Only plain data can cross between states
+
+    worker.set_function("run", [server](std::string source, sol::protected_function callback, sol::object arg) {
+        std::string args;
+        script_value_serialize(args, arg);
+        u64 id = script_worker_submit(server, std::move(source), std::move(args));
+        server->script.worker_pending[id] = { .callback = std::move(callback) };
+    });
+
+    worker.set_function("call", sol::yielding([server](sol::this_state ts, std::string source, sol::object arg) {
+        ScriptTask* task = script_task_get_current(server, ts, "worker.call");
+
+        std::string args;
+        script_value_serialize(args, arg);
+        u64 id = script_worker_submit(server, std::move(source), std::move(args));
+        server->script.worker_pending[id] = { .task = ts };
+
+        task->wait = ScriptTaskWait::worker;
+    }));
+}
+
+// -----------------------------------------------------------------------------
+
+// Hook events are queued while the compositor dispatches and delivered once per
+// event loop iteration, with each hook receiving all of its pending events in a
+// single call. Hooks that are repeatedly slow are disabled
+
+namespace {
+    constexpr auto script_hook_slow_threshold = 2ms;
+    constexpr u32  script_hook_max_slow_calls = 5;
+}
+
+static
+void script_hook_retire(Server* server, ScriptHookType type)
+{
+    // Stats are kept when a hook goes away, so debug.hooks() can still show
+    // what a misbehaving hook cost before it was removed
+
+    auto& hook = server->script.hooks[type];
+    if (hook.calls) {
+        auto& retired = server->script.hooks_retired[type];
+        retired.total += hook.total;
+        retired.calls += hook.calls;
+        retired.hooks++;
+    }
+    hook = {};
+}
+
+static
+void script_hooks_dispatch(Server* server)
+{
+    auto& lua = server->script.lua;
+
+    server->script.hook_dispatch = nullptr;
+    auto events = std::move(server->script.hook_queue);
+    server->script.hook_queue.clear();
+
+    config_batch_begin(server);
+    defer { config_batch_end(server); };
+
+    for (ScriptHookType type : magic_enum::enum_values<ScriptHookType>()) {
+        auto& hook = server->script.hooks[type];
+        if (!hook.function.valid()) continue;
+
+        sol::table list = lua.create_table();
+        for (auto& event : events) {
+            if (event.type != type) continue;
+            if (type == ScriptHookType::output) {
+                list.add(lua.create_table_with("name", event.output, "added", event.added));
+            } else {
+                list.add(lua.create_table_with("id", event.window_id, "app_id", event.app_id, "title", event.title));
+            }
+        }
+        if (list.empty()) continue;
+
+        auto name = magic_enum::enum_name(type);
+        auto start = std::chrono::steady_clock::now();
+        bool ok = script_invoke_safe(server, std::format("hook:{}", name), [&] { return hook.function(list); });
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        hook.total += elapsed;
+        hook.calls++;
+
+        if (!ok) {
+            log_error("Exception in {} hook, removing", name);
+            script_hook_retire(server, type);
+        } else if (elapsed > script_hook_slow_threshold) {
+            log_warn("Slow {} hook: {} for {} event(s)", name, duration_to_string(elapsed), list.size());
+            if (++hook.slow_calls >= script_hook_max_slow_calls) {
+                log_error("Hook {} was slow {} times in a row, removing", name, hook.slow_calls);
+                script_hook_retire(server, type);
+            }
+        } else {
+            hook.slow_calls = 0;
+        }
+    }
+}
+
+static
+void script_hook_queue(Server* server, ScriptHookEvent&& event)
+{
+    server->script.hook_queue.emplace_back(std::move(event));
+
+    if (!server->script.hook_dispatch) {
+        server->script.hook_dispatch = wl_event_loop_add_idle(wl_display_get_event_loop(server->display), [](void* data) {
+            script_hooks_dispatch(static_cast<Server*>(data));
+        }, server);
+    }
+}
+
+void script_hook_queue_toplevel(Toplevel* toplevel, ScriptHookType type)
+{
+    Server* server = toplevel->server;
+    if (!server->script.hooks[type].function.valid()) return;
+
+    const char* title = toplevel->xdg_toplevel()->title;
+    script_hook_queue(server, ScriptHookEvent {
+        .type = type,
+        .window_id = toplevel->id,
+        .app_id = std::string(toplevel->app_id()),
+        .title = title ? title : "",
+    });
+}
+
+void script_hook_queue_output(Output* output, bool added)
+{
+    Server* server = output->server;
+    if (!server->script.hooks[ScriptHookType::output].function.valid()) return;
+
+    script_hook_queue(server, ScriptHookEvent {
+        .type = ScriptHookType::output,
+        .output = output->wlr_output->name,
+        .added = added,
+    });
+}
+
+void script_hooks_cleanup(Server* server)
+{
+    if (server->script.hook_dispatch) {
+        wl_event_source_remove(server->script.hook_dispatch);
+        server->script.hook_dispatch = nullptr;
+    }
+    server->script.hook_queue.clear();
+    for (auto& hook : server->script.hooks._data) {
+        hook = {};
+    }
+}
+
+static
+std::optional<WindowRulePattern> script_object_to_rule_pattern(sol::object obj, std::string_view field)
+{
+    if (!obj.valid()) return std::nullopt;
+
+    std::optional<WindowRulePattern> pattern;
+    if (obj.is<std::string>()) {
+        pattern = window_rule_pattern_compile(WindowRulePatternType::exact, obj.as<std::string>());
+    } else if (obj.is<sol::table>()) {
+        sol::table table = obj.as<sol::table>();
+        for (auto type : magic_enum::enum_values<WindowRulePatternType>()) {
+            if (auto str = table.get<std::optional<std::string>>(magic_enum::enum_name(type))) {
+                pattern = window_rule_pattern_compile(type, *str);
+                break;
+            }
+        }
+    }
+
+    if (!pattern) {
+        script_error("Invalid pattern for window rule field {}", field);
+    }
+
+    return pattern;
+}
+
+static
+EnumMap<i32, BorderCorners> script_object_to_corner_radius(sol::object obj)
+{
+    EnumMap<i32, BorderCorners> radius;
+    if (obj.is<i32>()) {
+        for (auto& e : radius._data) e = obj.as<i32>();
+    } else if (obj.is<sol::table>()) {
+        sol::table table = obj.as<sol::table>();
+        radius[BorderCorners::TopLeft]     = table.get_or("top_left",     BorderUnset);
+        radius[BorderCorners::TopRight]    = table.get_or("top_right",    BorderUnset);
+        radius[BorderCorners::BottomLeft]  = table.get_or("bottom_left",  BorderUnset);
+        radius[BorderCorners::BottomRight] = table.get_or("bottom_right", BorderUnset);
+    } else {
+        script_error("Invalid window rule radius, got: {}", magic_enum::enum_name(obj.get_type()));
+    }
+    return radius;
+}
+
+static
+WindowRule script_table_to_window_rule(sol::table table)
+{
+    WindowRule rule;
+
+    rule.app_id          = script_object_to_rule_pattern(table["app_id"],    "app_id");
+    rule.title           = script_object_to_rule_pattern(table["title"],     "title");
+    rule.layer_namespace = script_object_to_rule_pattern(table["namespace"], "namespace");
+
+    rule.border        = table.get<std::optional<bool>>("border");
+    rule.close_on_quit = table.get<std::optional<bool>>("close_on_quit");
+
+    if (sol::object radius = table["radius"]; radius.valid()) {
+        rule.radius = script_object_to_corner_radius(radius);
+    }
+
+    return rule;
+}
+
+static
+void script_env_set_globals(Server* server)
+{
+    auto& lua = server->script.lua;
+
+    lua.set_function("spawn", [server](sol::variadic_args varargs) {
+        std::vector<std::string> args;
+        for (auto arg : varargs) {
+            args.emplace_back(arg.get<std::string>());
+        }
+        std::vector<std::string_view> argview(args.begin(), args.end());
+        pid_t pid = spawn(server, argview.front(), argview);
+        return pid ? std::optional(pid) : std::nullopt;
+    });
+
+    lua.set_function("xwayland", [server](const char* requested_socket, sol::protected_function callback) {
+        xwayland_satellite_spawn(server, requested_socket, [server, callback = std::move(callback)](std::string_view socket) {
+            script_invoke_safe(server, "xwayland", [&] { return callback(socket); });
+        });
+    });
+
+    sol::table config = lua["config"].get_or_create<sol::table>();
+
+    config.set_function("batch", [server](sol::protected_function fn) {
+        config_batch_begin(server);
+        defer { config_batch_end(server); };
+        auto res = fn();
+        if (!res.valid()) {
+            sol::error err = res;
+            throw err;
+        }
+    });
+
+    // Output
+
+    {
+        ScriptObjectBuilder output(lua, config["output"]);
+
+        output.add_property("on_add_or_remove", [server](sol::object listener) {
+            if (!listener.valid()) {
+                log_info("Clearing output layout add/remove listener");
+                server->script.on_output_add_or_remove = [](Output*, bool) {};
+                return;
+            }
+            if (!listener.is<sol::protected_function>()) {
+                script_error("Invalid output add/remove listener, got: {}", magic_enum::enum_name(listener.get_type()));
+            }
+            log_info("Setting output layout add/remove listener");
+            server->script.on_output_add_or_remove = [server, fn = listener.as<sol::protected_function>()](Output* output, bool added) {
+                log_info("Output added/removed");
+                script_invoke_safe(server, "output.on_add_or_remove", [&] {
+                    return output
+                        ? fn(output->wlr_output->name, added)
+                        : fn();
+                });
+            };
+            server->script.on_output_add_or_remove(nullptr, true);
+        }, [] { return sol::nil; });
+    }
+
+    // Keyboard
+
+    {
+        ScriptObjectBuilder keyboard(lua, config["keyboard"]);
+
+        keyboard.add_property("layout", [server](std::string layout) {
+            log_info("Setting keyboard.layout = {}", layout);
+            server->config.keyboard.layout = std::move(layout);
+            config_mark_dirty(server, ConfigDirty::keymaps);
+        }, [server] { return server->config.keyboard.layout; });
+
+        sol::table device = keyboard.add_table("device");
+
+        sol::table mt = device[sol::metatable_key].get_or_create<sol::table>();
+        mt["__newindex"] = [server](sol::table, std::string name, std::optional<std::string> layout) {
+            if (layout) {
+                log_info("Setting keyboard.device[\"{}\"] = {}", name, *layout);
+                server->config.keyboard.device_layouts[std::move(name)] = std::move(*layout);
+            } else {
+                log_info("Clearing keyboard.device[\"{}\"]", name);
+                server->config.keyboard.device_layouts.erase(name);
+            }
+            config_mark_dirty(server, ConfigDirty::keymaps);
+        };
+        mt["__index"] = [server](sol::table, std::string_view name) -> sol::optional<std::string> {
+            auto device_layout = server->config.keyboard.device_layouts.find(std::string(name));
+            if (device_layout == server->config.keyboard.device_layouts.end()) return sol::nullopt;
+            return device_layout->second;
+        };
+    }
+
+    // Pointer
+
+    {
+        ScriptObjectBuilder pointer(lua, config["pointer"]);
+
+        pointer.add_property("accel", [server](std::string name) {
+            log_info("Setting pointer.accel = {}", name);
+            server->config.pointer.accel = std::move(name);
+            config_mark_dirty(server, ConfigDirty::pointer);
+        }, [server] { return server->config.pointer.accel; });
+
+        pointer.add_property("rel_accel", [server](std::string name) {
+            log_info("Setting pointer.rel_accel = {}", name);
+            server->config.pointer.rel_accel = std::move(name);
+            config_mark_dirty(server, ConfigDirty::pointer);
+        }, [server] { return server->config.pointer.rel_accel; });
+
+        {
+            sol::table profile = pointer.add_table("profile");
+
+            sol::table mt = profile[sol::metatable_key].get_or_create<sol::table>();
+            mt["__newindex"] = [server](sol::table, std::string name, std::optional<sol::table> points) {
+                if (!points) {
+                    log_info("Removing pointer.profile[\"{}\"]", name);
+                    server->config.pointer.profiles.erase(name);
+                    config_mark_dirty(server, ConfigDirty::pointer);
+                    return;
+                }
+
+                std::vector<vec2> control_points;
+                for (usz i = 1; i <= points->size(); ++i) {
+                    sol::object point = (*points)[i];
+                    if (!point.is<sol::table>()) {
+                        script_error("Error parsing pointer profile, expected {{speed, sensitivity}} at [{}]", i);
+                    }
+                    sol::table pair = point.as<sol::table>();
+                    if (!pair[1].is<f64>() || !pair[2].is<f64>()) {
+                        script_error("Error parsing pointer profile, expected {{speed, sensitivity}} at [{}]", i);
+                    }
+                    control_points.emplace_back(pair[1].get<f64>(), pair[2].get<f64>());
+                }
+
+                auto compiled = pointer_accel_profile_compile(std::move(control_points));
+                if (!compiled) {
+                    script_error("Pointer profile must have at least one control point");
+                }
+
+                log_info("Setting pointer.profile[\"{}\"] with {} control points", name, compiled->points.size());
+                server->config.pointer.profiles[std::move(name)] = std::move(compiled);
+                config_mark_dirty(server, ConfigDirty::pointer);
+            };
+            mt["__index"] = [server](sol::this_state ts, sol::table, std::string_view name) -> sol::object {
+                auto profile = server->config.pointer.profiles.find(std::string(name));
+                if (profile == server->config.pointer.profiles.end()) return sol::nil;
+
+                sol::state_view lua(ts);
+                sol::table points = lua.create_table();
+                for (vec2 point : profile->second->points) {
+                    points.add(lua.create_table_with(1, point.x, 2, point.y));
+                }
+                return points;
+            };
+        }
+
+        {
+            sol::table device = pointer.add_table("device");
+
+            sol::table mt = device[sol::metatable_key].get_or_create<sol::table>();
+            mt["__newindex"] = [server](sol::table, std::string name, std::optional<sol::table> profiles) {
+                if (profiles) {
+                    PointerDeviceConfig device_config {
+                        .accel     = profiles->get_or<std::string>("accel",     ""),
+                        .rel_accel = profiles->get_or<std::string>("rel_accel", ""),
+                    };
+                    log_info("Setting pointer.device[\"{}\"] = {{ accel = {}, rel_accel = {} }}", name, device_config.accel, device_config.rel_accel);
+                    server->config.pointer.devices[std::move(name)] = std::move(device_config);
+                } else {
+                    log_info("Clearing pointer.device[\"{}\"]", name);
+                    server->config.pointer.devices.erase(name);
+                }
+                config_mark_dirty(server, ConfigDirty::pointer);
+            };
+        }
+    }
+
+    // Focus cycle
+
+    {
+        ScriptObjectBuilder focus_cycle(lua, config["focus_cycle"]);
+
+        focus_cycle.add_property("opacity", [server](f32 opacity) {
+            server->config.layout.focus_cycle_unselected_opacity = opacity;
+            log_info("Setting focus_cycle.opacity = {}", opacity);
+            config_mark_dirty(server, ConfigDirty::opacity);
+        }, [server] { return server->config.layout.focus_cycle_unselected_opacity; });
+    }
+
+    // Layout
+
+    {
+        {
+            ScriptObjectBuilder background(lua, config["background"]);
+
+            background.add_property("color", [server](sol::object color) {
+                if (!script_config_assign(server->config.layout.background_color, script_object_to_color(color))) return;
+                log_info("Setting background.color = {}", glm::to_string(server->config.layout.background_color));
+                config_mark_dirty(server, ConfigDirty::background);
+            }, [server] { return script_color_to_object(server->config.layout.background_color); });
+
+            background.add_property("image", [server](std::string path) {
+                log_info("Setting background.image = {}", path);
+                server->config.layout.background_image = std::move(path);
+                background_set(server, server->config.layout.background_image.c_str());
+            }, [server] { return server->config.layout.background_image; });
+        }
+
+        {
+            ScriptObjectBuilder hook(lua, config["hook"]);
+
+            for (ScriptHookType type : magic_enum::enum_values<ScriptHookType>()) {
+                hook.add_property(std::string(magic_enum::enum_name(type)).c_str(), [server, type](sol::object fn) {
+                    if (fn.valid() && !fn.is<sol::protected_function>()) {
+                        script_error("Invalid {} hook, got: {}", magic_enum::enum_name(type), magic_enum::enum_name(fn.get_type()));
+                    }
+                    log_info("Setting {} hook", magic_enum::enum_name(type));
+                    script_hook_retire(server, type);
+                    if (fn.valid()) server->script.hooks[type].function = fn.as<sol::protected_function>();
+                }, [server, type] { return server->script.hooks[type].function; });
+            }
+        }
+
+        {
+            ScriptObjectBuilder script(lua, config["script"]);
+
+            script.add_property("heap_limit", [server](f64 mib) {
+                server->script.heap.limit = usz(std::max(0.0, mib) * 1024 * 1024);
+                server->script.heap.limit_reached = false;
+                log_info("Setting script heap limit: {:.1f} MiB", mib);
+            }, [server] { return f64(server->script.heap.limit) / (1024 * 1024); });
+
+            script.add_member("reload", sol::make_object(lua, [server] {
+                script_reload_schedule(server);
+            }));
+        }
+
+        {
+            ScriptObjectBuilder ipc(lua, config["ipc"]);
+
+            ipc.add_property("max_message_size", [server](f64 mib) {
+                server->ipc.max_message_size = std::max(ipc_min_message_size, u32(std::clamp(mib, 0.0, 1024.0) * 1024 * 1024));
+                log_info("Setting IPC max message size: {:.1f} MiB", f64(server->ipc.max_message_size) / (1024 * 1024));
+            }, [server] { return f64(server->ipc.max_message_size) / (1024 * 1024); });
+        }
+
+        {
+            ScriptObjectBuilder window(lua, config["window"]);
+
+            window.add_property("rules", [server](sol::object rules) {
+                if (rules.valid() && !rules.is<sol::table>()) {
+                    script_error("Invalid window rules, got: {}", magic_enum::enum_name(rules.get_type()));
+                }
+                // nil clears all rules. Rules are walked in sequence order, later
+                // matching rules override earlier ones
+                std::vector<WindowRule> compiled;
+                if (rules.valid()) {
+                    sol::table list = rules.as<sol::table>();
+                    for (usz i = 1; i <= list.size(); ++i) {
+                        sol::object rule = list[i];
+                        if (!rule.is<sol::table>()) {
+                            script_error("Invalid window rule at [{}], got: {}", i, magic_enum::enum_name(rule.get_type()));
+                        }
+                        compiled.emplace_back(script_table_to_window_rule(rule.as<sol::table>()));
+                    }
+                }
+                log_info("Setting {} window rule(s)", compiled.size());
+                window_rules_set(server, std::move(compiled));
+                server->script.window_rules = std::move(rules);
+                config_mark_dirty(server, ConfigDirty::borders | ConfigDirty::workarea);
+            }, [server] { return server->script.window_rules; });
+        }
+
+        {
+            ScriptObjectBuilder border(lua, config["border"]);
+
+            border.add_property("width", [server](i32 width) {
+                log_info("Setting border width: {}", width);
+                server->border_manager->border_width = width;
+                config_mark_dirty(server, ConfigDirty::borders);
+            }, [server] { return server->border_manager->border_width; });
+
+            border.add_property("radius", [server](i32 radius) {
+                log_info("Setting border radius: {}", radius);
+                server->border_manager->border_radius = radius;
+                config_mark_dirty(server, ConfigDirty::borders);
+            }, [server] { return server->border_manager->border_radius; });
 
             {
-                MetatableBuilder color(lua, grid.table["color"]);
+                ScriptObjectBuilder color(border, "color");
+
+                color.add_property("focused", [server](sol::object color) {
+                    if (!script_config_assign(server->border_manager->border_color_focused, script_object_to_color(color))) return;
+                    log_info("Setting border.color.focused = {}", glm::to_string(server->border_manager->border_color_focused));
+                    config_mark_dirty(server, ConfigDirty::borders);
+                }, [server] { return script_color_to_object(server->border_manager->border_color_focused); });
+
+                color.add_property("default", [server](sol::object color) {
+                    if (!script_config_assign(server->border_manager->border_color_unfocused, script_object_to_color(color))) return;
+                    log_info("Setting border.color.default = {}", glm::to_string(server->border_manager->border_color_unfocused));
+                    config_mark_dirty(server, ConfigDirty::borders);
+                }, [server] { return script_color_to_object(server->border_manager->border_color_unfocused); });
+            }
+        }
+
+        // Grid
+
+        {
+            ScriptObjectBuilder grid(lua, config["grid"]);
+
+            {
+                ScriptObjectBuilder leeway(grid, "leeway");
+
+                leeway.add_property("horizontal", [server](i32 amount) {
+                    log_info("Setting grid.leeway.horizontal = {}", amount);
+                    server->config.layout.zone_selection_leeway.x = amount;
+                }, [server] { return server->config.layout.zone_selection_leeway.x; });
+
+                leeway.add_property("vertical", [server](i32 amount) {
+                    log_info("Setting grid.leeway.vertical = {}", amount);
+                    server->config.layout.zone_selection_leeway.y = amount;
+                }, [server] { return server->config.layout.zone_selection_leeway.y; });
+            }
+
+            {
+                ScriptObjectBuilder color(grid, "color");
 
                 color.add_property("initial", [server](sol::object color) {
-                    server->config.layout.zone_color_inital = script_object_to_color(color);
+                    if (!script_config_assign(server->config.layout.zone_color_inital, script_object_to_color(color))) return;
                     log_info("Setting grid.color.initial = {}", glm::to_string(server->config.layout.zone_color_inital));
-                }, [] { return sol::nil; /* TODO */ });
+                }, [server] { return script_color_to_object(server->config.layout.zone_color_inital); });
 
                 color.add_property("selected", [server](sol::object color) {
-                    server->config.layout.zone_color_select = script_object_to_color(color);
+                    if (!script_config_assign(server->config.layout.zone_color_select, script_object_to_color(color))) return;
                     log_info("Setting grid.color.selected = {}", glm::to_string(server->config.layout.zone_color_select));
-                }, [] { return sol::nil; /* TODO */ });
+                }, [server] { return script_color_to_object(server->config.layout.zone_color_select); });
             }
 
             grid.add_property("width", [server](i32 width) {
@@ -268,19 +1676,19 @@ void script_env_set_globals(Server* server)
             }, [server] { return server->config.layout.zone_vertical_zones; });
 
             {
-                MetatableBuilder padding(lua, grid.table["pad"]);
+                ScriptObjectBuilder padding(grid, "pad");
 
                 padding.add_property("inner", [server](u32 size) {
                     log_info("Setting grid.pad.inner = {}", size);
                     server->config.layout.zone_internal_padding = size;
-                    scene_reconfigure(server);
+                    config_mark_dirty(server, ConfigDirty::workarea);
                 }, [server] { return server->config.layout.zone_internal_padding; });
 
 #define DIRECTIONAL_PADDING(Name) \
                     padding.add_property(#Name, [server](u32 size) { \
                         log_info("Setting grid.pad."#Name" = {}", size); \
                         server->config.layout.zone_external_padding.Name = size; \
-                        scene_reconfigure(server); \
+                        config_mark_dirty(server, ConfigDirty::workarea); \
                     }, [server] { return server->config.layout.zone_external_padding.Name; });
 
                 DIRECTIONAL_PADDING(left)
@@ -303,33 +1711,125 @@ void script_env_set_globals(Server* server)
         });
 
         sol::table mt = binds[sol::metatable_key].get_or_create<sol::table>();
-        mt["__newindex"] = [server](sol::table, std::string_view bind_str, std::optional<sol::protected_function> action) {
+        mt["__newindex"] = [server](sol::table, std::string_view bind_str, sol::object action) {
             auto bind = bind_from_string(server, bind_str);
-            if (!bind) log_error("Failed to parse bind string: {}", bind_str);
+            if (!bind) script_error("Failed to parse bind string: {}", bind_str);
+
+            auto& reload = server->script.reload;
+
+            if (!action.valid()) {
+                std::erase(reload.binds, *bind);
+                bind_erase(server, *bind);
+                return;
+            }
+
+            if (action.is<BindAction>() && !(bind->modifiers >= action.as<BindAction&>().required_modifiers)) {
+                script_error("Action [{}] can't be bound to [{}], it requires the main modifier", action.as<BindAction&>().name, bind_str);
+            }
 
-            if (action) {
+            if (!reload.loading || std::ranges::none_of(server->command_binds, [&](const CommandBind& cb) { return cb.bind == bind.value(); })) {
                 log_info("Creating bind: {}", bind_str);
+            }
 
+            if (action.is<BindAction>()) {
                 bind_register(server, CommandBind {
                     .bind = bind.value(),
-                    .function = [bind = bind.value(), server, bind_str = std::string(bind_str), action = std::move(*action)] {
+                    .name = std::string(bind_str),
+                    .function = [bind_str = std::string(bind_str), native = action.as<BindAction>()] {
+                        log_debug("Executing bind: {} -> {}", bind_str, native.name);
+                        native.function();
+                    },
+                });
+            } else if (action.is<sol::protected_function>()) {
+                bind_register(server, CommandBind {
+                    .bind = bind.value(),
+                    .name = std::string(bind_str),
+                    .function = [bind = bind.value(), server, bind_str = std::string(bind_str), source = std::format("bind:{}", bind_str), action = action.as<sol::protected_function>()] {
                         log_info("Executing bind: {}", bind_str);
-                        if (!script_invoke_safe(action)) {
+                        if (!script_invoke_safe(server, source, action)) {
                             log_error("Exception while executing bind [{}], unregistering", bind_str);
                             bind_erase(server, bind);
                         }
                     },
                 });
             } else {
-                bind_erase(server, *bind);
+                script_error("Invalid action for bind [{}], got: {}", bind_str, magic_enum::enum_name(action.get_type()));
+            }
+
+            // Binds made outside of the config belong to whoever made them, and
+            // are kept when the config is reloaded
+
+            std::erase(reload.binds, bind.value());
+            if (reload.loading) {
+                reload.binds.emplace_back(bind.value());
             }
         };
     }
 
+    // Actions
+
+    {
+        // Native actions for binds. These are resolved once when the bind is
+        // created, and run directly on trigger without a Lua call
+
+        lua.new_usertype<BindAction>("Action",
+            sol::no_constructor,
+            "name", sol::readonly(&BindAction::name),
+            sol::meta_function::call, [](const BindAction& self) { self.function(); },
+            sol::meta_function::to_string, [](const BindAction& self) { return std::format("Action({})", self.name); });
+
+        sol::table action = lua["action"].get_or_create<sol::table>();
+
+        action.set_function("spawn", [server](sol::variadic_args varargs) {
+            struct SpawnArgs
+            {
+                std::vector<std::string> args;
+                std::vector<std::string_view> argv;
+            };
+
+            auto spawn_args = std::make_shared<SpawnArgs>();
+            for (auto arg : varargs) {
+                spawn_args->args.emplace_back(arg.get<std::string>());
+            }
+            if (spawn_args->args.empty()) {
+                script_error("action.spawn requires a program to run");
+            }
+            spawn_args->argv.assign(spawn_args->args.begin(), spawn_args->args.end());
+
+            return BindAction {
+                .name = std::format("spawn {}", spawn_args->args.front()),
+                .function = [server, spawn_args] {
+                    spawn(server, spawn_args->argv.front(), spawn_args->argv);
+                },
+            };
+        });
+
+        action.set_function("focus_cycle", [server](std::optional<bool> backwards) {
+            return BindAction {
+                .name = "focus_cycle",
+                .function = [server, backwards = backwards.value_or(false)] {
+                    focus_cycle_advance(server, backwards);
+                },
+                .required_modifiers = Modifiers::Mod,
+            };
+        });
+
+        action.set_function("close", [server] {
+            return BindAction {
+                .name = "close",
+                .function = [server] {
+                    if (Toplevel* focused = Toplevel::from(get_focused_surface(server))) {
+                        toplevel_close(focused);
+                    }
+                },
+            };
+        });
+    }
+
     // Process
 
     {
-        MetatableBuilder process(lua, lua["process"]);
+        ScriptObjectBuilder process(lua, lua["process"]);
 
         process.add_property("cwd",
             [](const char* cwd) { chdir(cwd); },
@@ -353,13 +1853,13 @@ void script_env_set_globals(Server* server)
     // Debug
 
     {
-        MetatableBuilder debug(lua, lua["debug"]);
+        ScriptObjectBuilder debug(lua, lua["debug"]);
 
         // Testing
 
-        debug.table.set_function("force_timeout", [] {
+        debug.add_member("force_timeout", sol::make_object(lua, [] {
             std::this_thread::sleep_for(10s);
-        });
+        }));
 
         // Cursor
 
@@ -372,7 +1872,7 @@ void script_env_set_globals(Server* server)
         // Pointer
 
         {
-            MetatableBuilder pointer(lua, debug.table["pointer"]);
+            ScriptObjectBuilder pointer(debug, "pointer");
 
             pointer.add_property("accel", [server](bool state) {
                 server->pointer.debug_accel_rate = state;
@@ -389,10 +1889,87 @@ void script_env_set_globals(Server* server)
             return server->scene->WLR_PRIVATE.debug_damage_option == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT;
         });
 
+        // Profiling
+
+        {
+            sol::table profile = debug.add_table("profile");
+
+            profile.set_function("start", [](sol::this_state ts, std::optional<i32> interval) {
+                script_profile.active = true;
+                script_profile.interval = std::max(1, interval.value_or(script_budget_hook_interval));
+                script_profile.stacks.clear();
+                script_profile.last_sample = std::chrono::steady_clock::now();
+                log_info("Started script profiler, sampling every {} instructions", script_profile.interval);
+
+                // Started from inside a script, so update the currently installed hook
+                lua_sethook(ts, script_budget_hook, LUA_MASKCOUNT, script_hook_interval());
+            });
+
+            profile.set_function("stop", [](sol::this_state ts) {
+                script_profile.active = false;
+                log_info("Stopped script profiler");
+                lua_sethook(ts, script_budget_hook, LUA_MASKCOUNT, script_hook_interval());
+            });
+
+            profile.set_function("dump", [](std::optional<std::string> path) {
+                auto out_path = path ? std::filesystem::path(*path) : std::filesystem::path(PROGRAM_NAME "-profile.folded");
+
+                std::ofstream out(out_path);
+                if (!out) {
+                    script_error("Failed to open profile output: {}", out_path.c_str());
+                }
+
+                std::chrono::nanoseconds total = {};
+                for (auto& [stack, time] : script_profile.stacks) {
+                    out << std::format("{} {}\n", stack, std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+                    total += time;
+                }
+
+                log_info("Wrote {} stacks ({}) to {}", script_profile.stacks.size(), duration_to_string(total), std::filesystem::absolute(out_path).c_str());
+            });
+        }
+
+        // Heap
+
+        debug.add_member("heap", sol::make_object(lua, [server] {
+            auto& heap = server->script.heap;
+            auto mib = [](usz bytes) { return f64(bytes) / (1024 * 1024); };
+
+            log_info("Script heap: {:.2f} MiB live, {:.2f} MiB peak, {:.2f} MiB pooled, limit {}",
+                mib(heap.total), mib(heap.peak), mib(heap.blocks.size() * ScriptHeap::block_size),
+                heap.limit ? std::format("{:.2f} MiB", mib(heap.limit)) : "none");
+
+            std::vector<const ScriptHeapSource*> sources;
+            for (auto& source : heap.sources) sources.emplace_back(&source);
+            std::ranges::sort(sources, std::greater{}, &ScriptHeapSource::bytes);
+
+            for (auto* source : sources) {
+                if (!source->allocations) continue;
+                log_info("{}{:.2f} MiB allocated in {} allocation(s) by {}", log_indent, mib(source->bytes), source->allocations, source->name);
+            }
+        }));
+
+        // Hooks
+
+        debug.add_member("hooks", sol::make_object(lua, [server] {
+            for (ScriptHookType type : magic_enum::enum_values<ScriptHookType>()) {
+                auto& hook = server->script.hooks[type];
+                if (hook.calls) {
+                    log_info("Hook {}: {} call(s), total {}, average {}", magic_enum::enum_name(type),
+                        hook.calls, duration_to_string(hook.total), duration_to_string(hook.total / hook.calls));
+                }
+                auto& retired = server->script.hooks_retired[type];
+                if (retired.calls) {
+                    log_info("Hook {} (removed, {} hook(s)): {} call(s), total {}, average {}", magic_enum::enum_name(type),
+                        retired.hooks, retired.calls, duration_to_string(retired.total), duration_to_string(retired.total / retired.calls));
+                }
+            }
+        }));
+
         // Outputs
 
         {
-            sol::table output = debug.table["output"].get_or_create<sol::table>();
+            sol::table output = debug.add_table("output");
 
             output.set_function("new", [server] {
                 if (server->session.window_backend) {
@@ -404,43 +1981,667 @@ void script_env_set_globals(Server* server)
     }
 }
 
+static
+void script_config_view_init(Server* server)
+{
+    // Expose a read-only LuaJIT FFI view of read-mostly config, so that scripts
+    // can read it in loops without going through any metamethods
+
+    auto& lua = server->script.lua;
+
+    script_config_view_update(server);
+
+    auto chunk = lua.load(std::format(R"(
+        local ffi, view = ...
+        ffi.cdef[[{}]]
+        config.view = ffi.cast("const struct zen_config_view*", view)
+    )", script_config_view_cdef));
+
+    // The ffi library is only handed to this chunk. Left reachable, any script
+    // (including fragments sent over IPC) could write arbitrary memory, call
+    // native functions or cast the const away from the view
+
+    sol::object ffi = lua["ffi"];
+    lua["ffi"] = sol::nil;
+    lua.registry()["_LOADED"]["ffi"] = sol::nil;
+    if (sol::optional<sol::table> package = lua["package"]; package) {
+        (*package)["loaded"]["ffi"] = sol::nil;
+    }
+
+    if (!chunk.valid()) {
+        sol::error err = chunk;
+        log_error("Failed to load config view: {}", err.what());
+        return;
+    }
+
+    sol::protected_function setup = chunk;
+    script_invoke_safe(server, "config.view", [&] {
+        return setup(ffi, static_cast<void*>(&server->script.config_view));
+    });
+}
+
 void script_system_init(Server* server)
 {
     auto& lua = server->script.lua;
 
-    lua.open_libraries(sol::lib::base, sol::lib::math);
+    lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::ffi);
 
+    // Count hooks never fire inside compiled traces, so with the JIT on a tight
+    // loop (`while true do end`) would never see the budget and hang the compositor.
+    // Scripts here are short event handlers, the interpreter is fast enough
+    luaJIT_setmode(lua.lua_state(), 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+
+    script_object_register(server);
     script_env_set_globals(server);
+    script_async_register(server);
+    script_workers_register(server);
+    script_windows_register(server);
+    script_gc_init(server);
+    script_config_view_init(server);
 }
 
+// -----------------------------------------------------------------------------
+
+// Compiled chunks are cached as LuaJIT bytecode, one file per source path. A cache
+// entry is reused as-is when the source mtime and size match, and otherwise only
+// after the source content hash has been verified against the entry. The source
+// path follows the header, entries are keyed by a hash of it and may collide
+
+struct ScriptBytecodeHeader
+{
+    static constexpr u32 current_magic = 0x5a4c4232; // ZLB2
+
+    u32 magic;
+    u32 luajit_version;
+    i64 mtime;
+    u64 size;
+    u64 hash;
+    u32 path_size;
+    u32 _pad;
+};
+
 static
-sol::environment script_environment_create(Server* server, std::filesystem::path dir)
+std::filesystem::path script_bytecode_cache_path(Server* server, const std::filesystem::path& script_path)
 {
-    sol::state& lua = server->script.lua;
-    sol::environment e(lua, sol::create, lua.globals());
+    std::filesystem::path cache_dir;
+    if (const char* xdg_cache_home = getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home) {
+        cache_dir = xdg_cache_home;
+    } else {
+        cache_dir = server->session.home_dir / ".cache";
+    }
+
+    auto key = ankerl::unordered_dense::hash<std::string_view>{}(script_path.native());
+    return cache_dir / PROGRAM_NAME / "lua" / std::format("{:016x}.ljbc", key);
+}
+
+static
+bool script_bytecode_cache_read(const std::filesystem::path& path, const std::filesystem::path& script_path, ScriptBytecodeHeader& header, std::string& bytecode)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+    if (header.magic != ScriptBytecodeHeader::current_magic) return false;
+    if (header.luajit_version != LUAJIT_VERSION_NUM) return false;
+    if (header.path_size != script_path.native().size()) return false;
+
+    std::string entry_path(header.path_size, '\0');
+    if (!in.read(entry_path.data(), entry_path.size())) return false;
+    if (entry_path != script_path.native()) return false;
+
+    bytecode.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !bytecode.empty();
+}
+
+static
+void script_bytecode_cache_write(const std::filesystem::path& path, const std::filesystem::path& script_path, ScriptBytecodeHeader header, std::string_view bytecode)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    // Write to a temporary file first, so that a concurrent reader never sees a partial entry
+
+    auto tmp_path = path;
+    tmp_path += std::format(".{}.tmp", getpid());
+    {
+        header.path_size = u32(script_path.native().size());
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(script_path.native().data(), script_path.native().size());
+        out.write(bytecode.data(), bytecode.size());
+        if (!out) {
+            log_warn("Failed to write bytecode cache entry: {}", path.c_str());
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+}
+
+static
+sol::load_result script_load_file_cached(Server* server, const std::filesystem::path& script_path)
+{
+    auto& lua = server->script.lua;
+
+    auto path = std::filesystem::absolute(script_path).lexically_normal();
+    auto chunk_name = "@" + path.string();
+
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        // Let Lua report the error
+        return lua.load_file(path.string());
+    }
+
+    auto cache_path = script_bytecode_cache_path(server, path);
+
+    ScriptBytecodeHeader header;
+    std::string bytecode;
+    bool cached = script_bytecode_cache_read(cache_path, path, header, bytecode);
+
+    // An entry that LuaJIT refuses (corrupt, or from a build with different
+    // bytecode) is never fatal, the source is compiled and the entry rewritten
+
+    if (cached && header.mtime == mtime.time_since_epoch().count() && header.size == size) {
+        log_debug("Loading [{}] from bytecode cache", path.c_str());
+        auto chunk = lua.load(bytecode, chunk_name, sol::load_mode::binary);
+        if (chunk.valid()) return chunk;
+        log_warn("Discarding bytecode cache entry for [{}]", path.c_str());
+        cached = false;
+    }
+
+    std::string source;
+    {
+        std::ifstream in(path, std::ios::binary);
+        source.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    ScriptBytecodeHeader new_header {
+        .magic = ScriptBytecodeHeader::current_magic,
+        .luajit_version = LUAJIT_VERSION_NUM,
+        .mtime = mtime.time_since_epoch().count(),
+        .size = size,
+        .hash = ankerl::unordered_dense::hash<std::string_view>{}(source),
+    };
+
+    if (cached && header.hash == new_header.hash) {
+        // Touched but unchanged, refresh the entry so the next load skips hashing
+        log_debug("Loading [{}] from bytecode cache (content unchanged)", path.c_str());
+        auto chunk = lua.load(bytecode, chunk_name, sol::load_mode::binary);
+        if (chunk.valid()) {
+            script_bytecode_cache_write(cache_path, path, new_header, bytecode);
+            return chunk;
+        }
+        log_warn("Discarding bytecode cache entry for [{}]", path.c_str());
+    }
+
+    auto chunk = lua.load(source, chunk_name, sol::load_mode::text);
+    if (!chunk.valid()) return chunk;
+
+    // Dump the freshly compiled chunk into the cache
+
+    lua_State* L = lua.lua_state();
+    bytecode.clear();
+    chunk.push();
+    lua_dump(L, [](lua_State*, const void* data, size_t size, void* ud) -> i32 {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(data), size);
+        return 0;
+    }, &bytecode);
+    lua_pop(L, 1);
+
+    log_debug("Compiled [{}], caching {} bytes of bytecode", path.c_str(), bytecode.size());
+    script_bytecode_cache_write(cache_path, path, new_header, bytecode);
+
+    return chunk;
+}
+
+namespace {
+    // Every new working directory used over IPC gets an environment, bound them
+    constexpr usz script_environment_max_count = 32;
+}
+
+static
+void script_environment_evict(Server* server)
+{
+    auto& environments = server->script.environments;
+
+    auto oldest = environments.end();
+    usz unpinned = 0;
+    for (auto iter = environments.begin(); iter != environments.end(); ++iter) {
+        if (iter->second.config) continue;
+        unpinned++;
+        if (oldest == environments.end() || iter->second.last_used < oldest->second.last_used) {
+            oldest = iter;
+        }
+    }
+
+    if (unpinned < script_environment_max_count || oldest == environments.end()) return;
+
+    log_debug("Evicting script environment for [{}]", oldest->first);
+    environments.erase(oldest);
+}
+
+static
+sol::environment script_environment_get(Server* server, std::filesystem::path dir)
+{
+    // Environments are cached per source directory so that repeated messages
+    // (e.g. status bars polling through IPC) don't rebuild them each time.
+    // Globals assigned by scripts persist in the environment until it is reset
+    // or, if the config never loaded anything from its directory, evicted
 
     dir = std::filesystem::absolute(dir);
 
+    auto& script = server->script;
+    auto& environments = script.environments;
+    if (auto e = environments.find(dir.native()); e != environments.end()) {
+        e->second.last_used = ++script.environment_clock;
+        e->second.config |= script.reload.loading;
+        return e->second.env;
+    }
+
+    script_environment_evict(server);
+
+    sol::state& lua = script.lua;
+    sol::environment e(lua, sol::create, lua.globals());
+
     e.set_function("source", [server, dir](std::string_view path) {
         log_debug("Sourcing [{}] -> {}", path, (dir / path).c_str());
         script_run_file(server, dir / path);
     });
 
+    e.set_function("reset_environment", [server, dir] {
+        log_debug("Resetting script environment for [{}]", dir.c_str());
+        server->script.environments.erase(dir.native());
+    });
+
+    environments.emplace(dir.native(), ScriptEnvironment {
+        .env = e,
+        .last_used = ++script.environment_clock,
+        .config = script.reload.loading,
+    });
+
     return e;
 }
 
+void script_environments_reset(Server* server)
+{
+    log_debug("Resetting {} script environment(s)", server->script.environments.size());
+    server->script.environments.clear();
+}
+
 void script_run(Server* server, std::string_view source, const std::filesystem::path& source_dir)
 {
-    auto e = script_environment_create(server, source_dir);
-    script_invoke_safe([&] {
+    config_batch_begin(server);
+    defer { config_batch_end(server); };
+
+    auto e = script_environment_get(server, source_dir);
+    script_invoke_safe(server, "script", [&] {
         return server->script.lua.safe_script(source, e);
     });
 }
 
-void script_run_file(Server* server, const std::filesystem::path& script_path)
+static
+void script_value_to_json(std::string& out, sol::object value, u32 depth = 0)
+{
+    if (depth > 32) {
+        throw std::runtime_error("value is nested too deeply (cyclic table?)");
+    }
+
+    switch (value.get_type()) {
+        case sol::type::lua_nil:
+            out += "null";
+            break;
+        case sol::type::boolean:
+            out += value.as<bool>() ? "true" : "false";
+            break;
+        case sol::type::number: {
+            f64 number = value.as<f64>();
+            if (!std::isfinite(number)) {
+                out += "null";
+            } else if (number == std::trunc(number) && std::abs(number) < 0x1p53) {
+                std::format_to(std::back_inserter(out), "{}", i64(number));
+            } else {
+                std::format_to(std::back_inserter(out), "{}", number);
+            }
+            break;
+        }
+        case sol::type::string:
+            json_append_string(out, value.as<std::string_view>());
+            break;
+        case sol::type::table: {
+            // Tables with only contiguous integer keys from 1 are encoded as arrays
+            sol::table table = value.as<sol::table>();
+            usz length = table.size();
+            usz count = 0;
+            for (auto _ : table) count++;
+
+            if (length && length == count) {
+                out += '[';
+                for (usz i = 1; i <= length; ++i) {
+                    if (i > 1) out += ',';
+                    script_value_to_json(out, table[i], depth + 1);
+                }
+                out += ']';
+            } else {
+                out += '{';
+                bool first = true;
+                for (auto[k, v] : table) {
+                    if (!first) out += ',';
+                    first = false;
+                    if (k.get_type() == sol::type::string) {
+                        json_append_string(out, k.as<std::string_view>());
+                    } else {
+                        std::string key;
+                        script_value_to_json(key, k, depth + 1);
+                        json_append_string(out, key);
+                    }
+                    out += ':';
+                    script_value_to_json(out, v, depth + 1);
+                }
+                out += '}';
+            }
+            break;
+        }
+        default:
+            json_append_string(out, std::format("<{}>", magic_enum::enum_name(value.get_type())));
+    }
+}
+
+bool script_eval(Server* server, std::string_view source, const std::filesystem::path& source_dir, std::string& result)
 {
-    auto e = script_environment_create(server, script_path.parent_path());
-    script_invoke_safe([&] {
-        return server->script.lua.safe_script_file(script_path, e);
+    config_batch_begin(server);
+    defer { config_batch_end(server); };
+
+    auto e = script_environment_get(server, source_dir);
+
+    bool ok = false;
+    result.clear();
+
+    script_invoke_safe(server, "ipc", [&] {
+        auto res = server->script.lua.safe_script(source, e, sol::script_pass_on_error);
+        if (res.valid()) {
+            try {
+                result += '[';
+                for (i32 i = 0; i < res.return_count(); ++i) {
+                    if (i) result += ',';
+                    script_value_to_json(result, res.get<sol::object>(i));
+                }
+                result += ']';
+                ok = true;
+            } catch (const std::exception& err) {
+                result = err.what();
+            }
+        } else {
+            sol::error err = res;
+            result = err.what();
+        }
+        if (!ok) {
+            // The error is returned in the reply, only log it locally rather than
+            // also forwarding it to the client's stderr
+            auto* sink = log_get_message_sink();
+            log_set_message_sink(nullptr);
+            log_error("Script error in ipc: {}", result);
+            log_set_message_sink(sink);
+        }
+        return res;
     });
+
+    return ok;
+}
+
+void script_run_file(Server* server, const std::filesystem::path& script_path)
+{
+    config_batch_begin(server);
+    defer { config_batch_end(server); };
+
+    if (server->script.reload.loading) {
+        script_reload_track(server, script_path);
+    }
+
+    auto chunk = script_load_file_cached(server, script_path);
+    if (!chunk.valid()) {
+        sol::error err = chunk;
+        log_error("Script error: {}", err.what());
+        server->script.reload.failed = true;
+        return;
+    }
+
+    sol::protected_function fn = chunk;
+    sol::set_environment(script_environment_get(server, script_path.parent_path()), fn);
+    if (!script_invoke_safe(server, script_path.string(), [&] { return fn(); })) {
+        server->script.reload.failed = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+namespace {
+    constexpr auto script_reload_debounce_ms = 100;
+    constexpr u32  script_reload_watch_mask  = IN_CLOSE_WRITE | IN_MOVED_TO;
+}
+
+static
+void script_reload_watch(Server* server, const std::filesystem::path& dir)
+{
+    auto& reload = server->script.reload;
+
+    // Watch directories rather than files, editors commonly save by replacing the file
+    i32 wd = inotify_add_watch(reload.inotify_fd, dir.c_str(), script_reload_watch_mask);
+    if (wd < 0) {
+        log_error("Failed to watch [{}] for changes: {}", dir.c_str(), strerror(errno));
+        return;
+    }
+
+    reload.watches.try_emplace(wd, dir);
+}
+
+void script_reload_track(Server* server, const std::filesystem::path& script_path)
+{
+    auto& reload = server->script.reload;
+
+    auto path = std::filesystem::absolute(script_path).lexically_normal();
+    if (!reload.files.try_emplace(path.native(), true).second) return;
+
+    if (reload.inotify_fd >= 0) {
+        script_reload_watch(server, path.parent_path());
+    }
+}
+
+static
+int script_reload_handle_inotify(i32 fd, u32, void* data)
+{
+    Server* server = static_cast<Server*>(data);
+    auto& reload = server->script.reload;
+
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+
+    for (;;) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) break;
+
+        for (char* ptr = buffer; ptr < buffer + len;) {
+            auto* event = reinterpret_cast<inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            auto dir = reload.watches.find(event->wd);
+            if (dir == reload.watches.end() || !event->len) continue;
+
+            auto path = dir->second / event->name;
+            if (reload.files.contains(path.native())) {
+                log_debug("Script [{}] changed", path.c_str());
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) {
+        script_reload_schedule(server);
+    }
+
+    return 0;
+}
+
+static
+int script_reload_handle_timer(void* data)
+{
+    script_reload(static_cast<Server*>(data));
+    return 0;
+}
+
+void script_reload_init(Server* server, std::vector<std::filesystem::path> roots)
+{
+    auto& reload = server->script.reload;
+    reload.roots = std::move(roots);
+
+    auto* event_loop = wl_display_get_event_loop(server->display);
+    reload.timer = wl_event_loop_add_timer(event_loop, script_reload_handle_timer, server);
+
+    reload.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload.inotify_fd < 0) {
+        log_error("Failed to initialize inotify, scripts will not be reloaded on change: {}", strerror(errno));
+        return;
+    }
+
+    reload.source = wl_event_loop_add_fd(event_loop, reload.inotify_fd, WL_EVENT_READABLE, script_reload_handle_inotify, server);
+
+    // Files loaded before the watcher existed
+    for (auto& [file, _] : reload.files) {
+        script_reload_watch(server, std::filesystem::path(file).parent_path());
+    }
+
+    log_debug("Watching {} script file(s) for changes", reload.files.size());
+}
+
+void script_reload_schedule(Server* server)
+{
+    // Editors tend to emit several events per save, coalesce them into one reload
+    if (server->script.reload.timer) {
+        wl_event_source_timer_update(server->script.reload.timer, script_reload_debounce_ms);
+    }
+}
+
+void script_reload_run_root(Server* server, const std::filesystem::path& script_path)
+{
+    auto& reload = server->script.reload;
+
+    if (!reload.generation) reload.generation = 1;
+
+    reload.loading = true;
+    defer { reload.loading = false; };
+
+    script_run_file(server, script_path);
+}
+
+static
+void script_reload_reset_object(Server* server, ScriptObject& object, const std::string& path)
+{
+    auto& reload = server->script.reload;
+
+    for (auto& [name, prop] : object.properties) {
+        if (!prop.generation || prop.generation == reload.generation) continue;
+
+        log_info("Resetting {}.{}, no longer set by the config", path, name);
+        try {
+            prop.set(prop.initial);
+        } catch (const std::exception&) {
+            // Already reported by the setter
+        }
+
+        prop.generation = 0;
+        prop.initial = sol::nil;
+    }
+
+    for (auto& [name, member] : object.members) {
+        if (member.is<ScriptObject>()) {
+            script_reload_reset_object(server, member.as<ScriptObject&>(), path + "." + name);
+        }
+    }
+}
+
+void script_reload(Server* server)
+{
+    auto& reload = server->script.reload;
+
+    if (reload.loading) return;
+
+    log_info("Reloading {} startup script(s)", reload.roots.size());
+    auto start = std::chrono::steady_clock::now();
+
+    config_batch_begin(server);
+    defer { config_batch_end(server); };
+
+    // Start the config from a clean slate, without touching anything it doesn't own
+
+    auto previous_files = std::move(reload.files);
+    auto previous_binds = std::move(reload.binds);
+    reload.files.clear();
+    reload.binds.clear();
+
+    {
+        ankerl::unordered_dense::set<std::string> dirs;
+        for (auto& [file, _] : previous_files) {
+            dirs.emplace(std::filesystem::path(file).parent_path().native());
+        }
+        auto& environments = server->script.environments;
+        for (auto iter = environments.begin(); iter != environments.end();) {
+            if (dirs.contains(std::filesystem::path(iter->first).lexically_normal().native())) {
+                iter = environments.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+
+    script_async_cancel_config(server);
+
+    reload.failed = false;
+    reload.generation++;
+
+    for (auto& root : reload.roots) {
+        script_reload_run_root(server, root);
+    }
+
+    // Binds and properties that weren't set again have been removed from the
+    // config. If the reload failed part way, leave them alone rather than
+    // dropping what simply wasn't reached
+
+    if (reload.failed) {
+        log_warn("Errors during reload, keeping existing binds and settings");
+        for (auto& [file, _] : previous_files) {
+            reload.files.try_emplace(file, true);
+        }
+        for (auto& bind : previous_binds) {
+            if (std::ranges::find(reload.binds, bind) == reload.binds.end()) {
+                reload.binds.emplace_back(bind);
+            }
+        }
+    } else {
+        std::erase_if(server->command_binds, [&](const CommandBind& cb) {
+            return std::ranges::contains(previous_binds, cb.bind)
+                && !std::ranges::contains(reload.binds, cb.bind);
+        });
+
+        sol::table config = server->script.lua["config"];
+        for (auto[key, value] : config) {
+            if (value.is<ScriptObject>() && key.is<std::string>()) {
+                script_reload_reset_object(server, value.as<ScriptObject&>(), "config." + key.as<std::string>());
+            }
+        }
+    }
+
+    log_info("Reload complete in {}", duration_to_string(std::chrono::steady_clock::now() - start));
+}
+
+void script_reload_cleanup(Server* server)
+{
+    auto& reload = server->script.reload;
+
+    if (reload.source) wl_event_source_remove(reload.source);
+    if (reload.timer)  wl_event_source_remove(reload.timer);
+    if (reload.inotify_fd >= 0) close(reload.inotify_fd);
+
+    reload.source = nullptr;
+    reload.timer = nullptr;
+    reload.inotify_fd = -1;
+    reload.watches.clear();
 }
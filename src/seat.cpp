@@ -14,10 +14,10 @@ void update_seat_caps(Server* server)
     wlr_seat_set_capabilities(server->seat, caps);
 }
 
-Modifiers get_modifiers(Server* server)
+static
+void input_state_update_modifiers(Server* server)
 {
-    wlr_keyboard* keyboard = wlr_seat_get_keyboard(server->seat);
-    u32 key_mods = keyboard ? wlr_keyboard_get_modifiers(keyboard) : 0;
+    u32 key_mods = server->input.key_modifiers;
 
     Modifiers mods = {};
     if (key_mods & WLR_MODIFIER_LOGO)     mods |= Modifiers::Super;
@@ -26,16 +26,55 @@ Modifiers get_modifiers(Server* server)
     if (key_mods & WLR_MODIFIER_ALT)      mods |= Modifiers::Alt;
     if (key_mods & server->main_modifier) mods |= Modifiers::Mod;
 
-    for (Pointer* pointer : server->pointers) {
+    if (server->input.modifier_buttons_down) mods |= Modifiers::Mod;
+
+    server->input.modifiers = mods;
+}
+
+void input_state_set_keyboard(Server* server, wlr_keyboard* keyboard)
+{
+    // NOTE: Modifiers are always taken from the seat's active keyboard, so this must
+    //       be called whenever the active keyboard or its modifier state changes
+
+    if (keyboard) wlr_seat_set_keyboard(server->seat, keyboard);
+
+    keyboard = wlr_seat_get_keyboard(server->seat);
+    server->input.key_modifiers = keyboard ? wlr_keyboard_get_modifiers(keyboard) : 0;
+
+    input_state_update_modifiers(server);
+}
+
+void input_state_update_pointer(Pointer* pointer)
+{
+    // Recount only this device's pressed buttons, the seat totals are then adjusted by the difference
+
+    Server* server = pointer->server;
+
+    server->input.buttons_down          -= pointer->buttons_down;
+    server->input.modifier_buttons_down -= pointer->modifier_buttons_down;
+
+    pointer->buttons_down = 0;
+    pointer->modifier_buttons_down = 0;
+
+    if (pointer->wlr_pointer) {
         for (u32 i = 0; i < pointer->wlr_pointer->button_count; ++i) {
             if (pointer->wlr_pointer->buttons[i] == pointer_modifier_button) {
-                mods |= Modifiers::Mod;
-                break;
+                pointer->modifier_buttons_down++;
+            } else {
+                pointer->buttons_down++;
             }
         }
     }
 
-    return mods;
+    server->input.buttons_down          += pointer->buttons_down;
+    server->input.modifier_buttons_down += pointer->modifier_buttons_down;
+
+    input_state_update_modifiers(server);
+}
+
+Modifiers get_modifiers(Server* server)
+{
+    return server->input.modifiers;
 }
 
 // -----------------------------------------------------------------------------
@@ -45,7 +84,7 @@ void keyboard_handle_modifiers(wl_listener* listener, void*)
     Keyboard* keyboard = listener_userdata<Keyboard*>(listener);
 
     // NOTE: Wayland only supports one keyboard at a time, so set the most recently used keyboard as the current one
-    wlr_seat_set_keyboard(keyboard->server->seat, keyboard->wlr_keyboard);
+    input_state_set_keyboard(keyboard->server, keyboard->wlr_keyboard);
 
     // Send modifiers to the client
     wlr_seat_keyboard_notify_modifiers(keyboard->server->seat, &keyboard->wlr_keyboard->modifiers);
@@ -79,7 +118,7 @@ void keyboard_handle_key(wl_listener* listener, void* data)
         event->state = WL_KEYBOARD_KEY_STATE_PRESSED;
     }
 
-    wlr_seat_set_keyboard(seat, keyboard->wlr_keyboard);
+    input_state_set_keyboard(server, keyboard->wlr_keyboard);
     wlr_seat_keyboard_notify_key(seat, event->time_msec, event->keycode, event->state);
 }
 
@@ -87,21 +126,126 @@ void keyboard_handle_destroy(wl_listener* listener, void*)
 {
     Keyboard* keyboard = listener_userdata<Keyboard*>(listener);
 
-    std::erase(keyboard->server->keyboards, keyboard);
+    Server* server = keyboard->server;
+
+    std::erase(server->keyboards, keyboard);
+
+    if (wlr_seat_get_keyboard(server->seat) == keyboard->wlr_keyboard) {
+        wlr_seat_set_keyboard(server->seat, nullptr);
+    }
+    input_state_set_keyboard(server, nullptr);
 
-    update_seat_caps(keyboard->server);
+    update_seat_caps(server);
 
     delete keyboard;
 
     // TODO: We need to unset wl_seat capabilities if this was the only keyboard
 }
 
-void seat_keyboard_focus_change(wl_listener*, void* data)
+void seat_keyboard_focus_change(wl_listener* listener, void* data)
 {
+    Server* server = listener_userdata<Server*>(listener);
     wlr_seat_keyboard_focus_change_event* event = static_cast<wlr_seat_keyboard_focus_change_event*>(data);
 
-    if (Toplevel* toplevel = Toplevel::from(event->old_surface)) borders_update(toplevel);
-    if (Toplevel* toplevel = Toplevel::from(event->new_surface)) borders_update(toplevel);
+    state_snapshot_mark_dirty(server);
+
+    if (Toplevel* toplevel = Toplevel::from(event->old_surface)) {
+        borders_update(toplevel);
+        script_windows_update(toplevel);
+    }
+    if (Toplevel* toplevel = Toplevel::from(event->new_surface)) {
+        borders_update(toplevel);
+        script_windows_update(toplevel);
+        script_hook_queue_toplevel(toplevel, ScriptHookType::focus);
+        ipc_publish_toplevel(toplevel, IpcTopic::focus);
+    }
+}
+
+xkb_keymap* keymap_get(Server* server, const xkb_rule_names& names)
+{
+    // Compiled keymaps are shared between all keyboards with matching rule names,
+    // so hotplugging a device only pays for a keymap compile the first time.
+    // Failed compiles are cached too, so a bad layout is only reported once
+
+    auto key = std::format("{}:{}:{}:{}:{}",
+        names.rules   ?: "",
+        names.model   ?: "",
+        names.layout  ?: "",
+        names.variant ?: "",
+        names.options ?: "");
+
+    if (auto cached = server->keymaps.cache.find(key); cached != server->keymaps.cache.end()) {
+        return cached->second;
+    }
+
+    if (!server->keymaps.context) {
+        server->keymaps.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    }
+
+    log_debug("Compiling keymap [{}]", key);
+
+    xkb_keymap* keymap = xkb_keymap_new_from_names(server->keymaps.context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!keymap) {
+        log_error("Failed to compile keymap [{}]", key);
+    }
+
+    server->keymaps.cache[key] = keymap;
+
+    return keymap;
+}
+
+void keymap_cache_destroy(Server* server)
+{
+    for (auto&[_, keymap] : server->keymaps.cache) {
+        if (keymap) xkb_keymap_unref(keymap);
+    }
+    server->keymaps.cache.clear();
+
+    if (server->keymaps.context) {
+        xkb_context_unref(server->keymaps.context);
+        server->keymaps.context = nullptr;
+    }
+}
+
+void keyboard_update_keymap(Keyboard* keyboard)
+{
+    Server* server = keyboard->server;
+    wlr_keyboard* wlr_keyboard = keyboard->wlr_keyboard;
+
+    const std::string* layout = &server->config.keyboard.layout;
+    if (const char* name = wlr_keyboard->base.name) {
+        auto device_layout = server->config.keyboard.device_layouts.find(name);
+        if (device_layout != server->config.keyboard.device_layouts.end()) {
+            layout = &device_layout->second;
+        }
+    }
+
+    xkb_keymap* keymap = keymap_get(server, xkb_rule_names {
+        .layout = layout->c_str(),
+    });
+
+    // Fall back to the configured default layout, then to the xkb defaults
+
+    if (!keymap && layout != &server->config.keyboard.layout) {
+        keymap = keymap_get(server, xkb_rule_names {
+            .layout = server->config.keyboard.layout.c_str(),
+        });
+    }
+
+    if (!keymap) {
+        keymap = keymap_get(server, xkb_rule_names {});
+    }
+
+    if (keymap && keymap != wlr_keyboard->keymap) {
+        wlr_keyboard_set_keymap(wlr_keyboard, keymap);
+    }
+}
+
+void keyboards_update_keymaps(Server* server)
+{
+    for (Keyboard* keyboard : server->keyboards) {
+        keyboard_update_keymap(keyboard);
+    }
 }
 
 void keyboard_new(Server* server, wlr_input_device* device)
@@ -112,25 +256,18 @@ void keyboard_new(Server* server, wlr_input_device* device)
     keyboard->server = server;
     keyboard->wlr_keyboard = wlr_keyboard;
 
-    xkb_context* context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    xkb_keymap* keymap = xkb_keymap_new_from_names(context, ptr(xkb_rule_names{
-        .layout = keyboard_layout,
-    }), XKB_KEYMAP_COMPILE_NO_FLAGS);
-
-    wlr_keyboard_set_keymap(wlr_keyboard, keymap);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(context);
+    keyboard_update_keymap(keyboard);
     wlr_keyboard_set_repeat_info(wlr_keyboard, keyboard_repeat_rate, keyboard_repeat_delay);
 
     keyboard->listeners.listen(&wlr_keyboard->events.modifiers, keyboard, keyboard_handle_modifiers);
     keyboard->listeners.listen(&wlr_keyboard->events.key,       keyboard, keyboard_handle_key);
     keyboard->listeners.listen(&      device->events.destroy,   keyboard, keyboard_handle_destroy);
 
-    wlr_seat_set_keyboard(server->seat, keyboard->wlr_keyboard);
+    input_state_set_keyboard(server, keyboard->wlr_keyboard);
 
     server->keyboards.emplace_back(keyboard);
 
-    if (wlr_input_device_is_libinput(device)) {
+    if (wlr_input_device_is_libinput(device) && wlr_keyboard->keymap) {
 
         // Set default numlock state
 
@@ -147,6 +284,10 @@ void pointer_destroy(wl_listener* listener, void*)
 
     log_info("Pointer destroyed: {}", pointer_to_string(pointer));
 
+    // Release any buttons still held on this device
+    pointer->wlr_pointer = nullptr;
+    input_state_update_pointer(pointer);
+
     std::erase(pointer->server->pointers, pointer);
 
     delete pointer;
@@ -154,15 +295,7 @@ void pointer_destroy(wl_listener* listener, void*)
 
 u32 get_num_pointer_buttons_down(Server* server)
 {
-    u32 count = 0;
-    for (Pointer* pointer : server->pointers) {
-        for (u32 i = 0; i < pointer->wlr_pointer->button_count; ++i) {
-            if (pointer->wlr_pointer->buttons[i] != pointer_modifier_button) {
-                count++;
-            }
-        }
-    }
-    return count;
+    return server->input.buttons_down;
 }
 
 void pointer_new(Server* server, wlr_input_device* device)
@@ -176,6 +309,8 @@ void pointer_new(Server* server, wlr_input_device* device)
 
     server->pointers.emplace_back(pointer);
 
+    pointer_update_accel(pointer);
+
     libinput_device* libinput_device;
     if (wlr_input_device_is_libinput(device) && (libinput_device = wlr_libinput_get_device_handle(device))) {
         if (libinput_device_config_accel_is_available(libinput_device)) {
@@ -437,6 +572,30 @@ void seat_drag_update_position(Server* server)
     wlr_scene_node_set_position(&server->drag_icon_parent->node, get_cursor_pos(server).x, get_cursor_pos(server).y);
 }
 
+static
+void cursor_schedule_latch(Server* server)
+{
+    // Scene nodes that follow the cursor are only repositioned once per frame, right
+    // before the scene is committed, so that they always use the most recent position
+
+    if (server->pointer.latch_pending) return;
+    if (!server->pointer.debug_visual_enabled && wl_list_empty(&server->drag_icon_parent->children)) return;
+
+    server->pointer.latch_pending = true;
+    for (Output* output : server->outputs) {
+        wlr_output_schedule_frame(output->wlr_output);
+    }
+}
+
+void cursor_latch_position(Server* server)
+{
+    if (!server->pointer.latch_pending) return;
+    server->pointer.latch_pending = false;
+
+    update_cursor_visual_position(server);
+    seat_drag_update_position(server);
+}
+
 // -----------------------------------------------------------------------------
 
 struct PointerConstraint
@@ -505,6 +664,7 @@ void set_interaction_mode(Server* server, InteractionMode mode)
     }
 
     server->interaction_mode = mode;
+    state_snapshot_mark_dirty(server);
 
     if (prev_mode == InteractionMode::move || prev_mode == InteractionMode::resize) {
         server->movesize.grabbed_toplevel.reset();
@@ -563,7 +723,7 @@ void process_cursor_resize(Server* server)
 void process_cursor_motion(Server* server, u32 time_msecs, wlr_input_device* device, vec2 delta, vec2 rel, vec2 rel_unaccel)
 {
     defer {
-        update_cursor_visual_position(server);
+        cursor_schedule_latch(server);
     };
 
     // Handle compositor interactions
@@ -704,17 +864,114 @@ void process_cursor_motion(Server* server, u32 time_msecs, wlr_input_device* dev
     } else {
         wlr_seat_pointer_notify_clear_focus(seat);
     }
+}
 
-    // Update drag
+std::shared_ptr<const PointerAccelProfile> pointer_accel_profile_compile(std::vector<vec2> points)
+{
+    if (points.empty()) return nullptr;
 
-    seat_drag_update_position(server);
+    std::sort(points.begin(), points.end(), [](vec2 l, vec2 r) { return l.x < r.x; });
+
+    auto profile = std::make_shared<PointerAccelProfile>();
+    profile->points = std::move(points);
+
+    const auto& p = profile->points;
+
+    f64 end = p.back().x;
+    if (p.size() == 1 || end <= 0) {
+        profile->table.fill(p.back().y);
+        profile->step = 1;
+        profile->tail_slope = 0;
+        return profile;
+    }
+
+    profile->step = end / (pointer_accel_table_size - 1);
+
+    usz segment = 0;
+    for (usz i = 0; i < pointer_accel_table_size; ++i) {
+        f64 speed = i * profile->step;
+        while (segment + 1 < p.size() - 1 && p[segment + 1].x <= speed) segment++;
+
+        vec2 a = p[segment];
+        vec2 b = p[segment + 1];
+        if (speed <= a.x) {
+            profile->table[i] = a.y;
+        } else if (speed >= b.x || b.x == a.x) {
+            profile->table[i] = b.y;
+        } else {
+            profile->table[i] = std::lerp(a.y, b.y, (speed - a.x) / (b.x - a.x));
+        }
+    }
+
+    vec2 a = p[p.size() - 2];
+    vec2 b = p[p.size() - 1];
+    profile->tail_slope = b.x > a.x ? (b.y - a.y) / (b.x - a.x) : 0;
+
+    return profile;
+}
+
+static
+f64 pointer_accel_profile_sample(const PointerAccelProfile& profile, f64 speed)
+{
+    static constexpr usz last = pointer_accel_table_size - 1;
+
+    f64 x = speed / profile.step;
+    if (x >= last) {
+        return profile.table[last] + (speed - last * profile.step) * profile.tail_slope;
+    }
+
+    usz i = usz(x);
+    return std::lerp(profile.table[i], profile.table[i + 1], x - i);
+}
+
+void pointer_accel_init(Server* server)
+{
+    // Built-in profiles matching the previous fixed curve:
+    //   multiplier * (1 + (max(speed, offset) - offset) * rate)
+
+    auto& profiles = server->config.pointer.profiles;
+    profiles["default"]  = pointer_accel_profile_compile({{0, 0.3}, {2, 0.3}, {3, 0.315}});
+    profiles["relative"] = pointer_accel_profile_compile({{0, 1.0}, {2, 1.0}, {3, 1.05 }});
+    profiles["flat"]     = pointer_accel_profile_compile({{0, 1.0}});
+}
+
+void pointer_update_accel(Pointer* pointer)
+{
+    auto& config = pointer->server->config.pointer;
+
+    std::string_view accel     = config.accel;
+    std::string_view rel_accel = config.rel_accel;
+
+    if (auto device = config.devices.find(pointer->wlr_pointer->base.name ?: ""); device != config.devices.end()) {
+        if (!device->second.accel.empty())     accel     = device->second.accel;
+        if (!device->second.rel_accel.empty()) rel_accel = device->second.rel_accel;
+    }
+
+    auto find_profile = [&](std::string_view name) -> std::shared_ptr<const PointerAccelProfile> {
+        auto profile = config.profiles.find(std::string(name));
+        if (profile != config.profiles.end()) return profile->second;
+        log_warn("Pointer acceleration profile not found: {}", name);
+        return nullptr;
+    };
+
+    // Profiles are immutable once compiled, so swapping the pointer here is the only update needed
+
+    pointer->accel     = find_profile(accel);
+    pointer->rel_accel = find_profile(rel_accel);
+}
+
+void pointers_update_accel_all(Server* server)
+{
+    for (Pointer* pointer : server->pointers) {
+        pointer_update_accel(pointer);
+    }
 }
 
 static
-vec2 pointer_acceleration_apply(Pointer* pointer, const PointerAccelConfig& config, vec2* remainder, vec2 delta)
+vec2 pointer_acceleration_apply(Pointer* pointer, const PointerAccelProfile* profile, vec2* remainder, vec2 delta)
 {
     f64 speed = glm::length(delta);
-    vec2 sens = vec2(config.multiplier * (1 + (std::max(speed, config.offset) - config.offset) * config.rate));
+    vec2 sens = vec2(profile ? pointer_accel_profile_sample(*profile, speed) : 1.0);
 
     vec2 new_delta = sens * delta;
 
@@ -738,8 +995,8 @@ void cursor_motion(wl_listener* listener, void* data)
     Pointer* pointer = Pointer::from(event->pointer);
 
     vec2 base = { event->delta_x, event->delta_y };
-    vec2 accel     = pointer_acceleration_apply(pointer, pointer_accel,     &pointer->accel_remainder,     base);
-    vec2 rel_accel = pointer_acceleration_apply(pointer, pointer_rel_accel, &pointer->rel_accel_remainder, base);
+    vec2 accel     = pointer_acceleration_apply(pointer, pointer->accel.get(),     &pointer->accel_remainder,     base);
+    vec2 rel_accel = pointer_acceleration_apply(pointer, pointer->rel_accel.get(), &pointer->rel_accel_remainder, base);
 
     process_cursor_motion(server, event->time_msec, &event->pointer->base, accel, rel_accel, base);
 }
@@ -778,6 +1035,10 @@ void cursor_button(wl_listener* listener, void* data)
     Server* server = listener_userdata<Server*>(listener);
     wlr_pointer_button_event* event = static_cast<wlr_pointer_button_event*>(data);
 
+    if (Pointer* pointer = Pointer::from(event->pointer)) {
+        input_state_update_pointer(pointer);
+    }
+
     if (input_handle_button(server, *event)) {
         return;
     }
@@ -831,6 +1092,18 @@ void binds_toplevel_close_or_kill_client(Toplevel* toplevel)
     toplevel_close(toplevel);
 }
 
+void focus_cycle_advance(Server* server, bool backwards)
+{
+    bool do_cycle = true;
+    if (server->interaction_mode ==  InteractionMode::passthrough) {
+        do_cycle = Toplevel::from(get_focused_surface(server));
+        focus_cycle_begin(server, nullptr);
+    }
+    if (do_cycle && server->interaction_mode == InteractionMode::focus_cycle) {
+        focus_cycle_step(server, nullptr, backwards);
+    }
+}
+
 bool input_handle_key(Server* server, const wlr_keyboard_key_event& event, xkb_keysym_t sym)
 {
     wl_keyboard_key_state state = event.state;
@@ -865,17 +1138,9 @@ bool input_handle_key(Server* server, const wlr_keyboard_key_event& event, xkb_k
                 server_request_quit(server, mods >= Modifiers::Shift);
                 break;
             case XKB_KEY_Tab:
-            case XKB_KEY_ISO_Left_Tab: {
-                bool do_cycle = true;
-                if (server->interaction_mode ==  InteractionMode::passthrough) {
-                    do_cycle = Toplevel::from(get_focused_surface(server));
-                    focus_cycle_begin(server, nullptr);
-                }
-                if (do_cycle && server->interaction_mode == InteractionMode::focus_cycle) {
-                    focus_cycle_step(server, nullptr, sym == XKB_KEY_ISO_Left_Tab);
-                }
+            case XKB_KEY_ISO_Left_Tab:
+                focus_cycle_advance(server, sym == XKB_KEY_ISO_Left_Tab);
                 return true;
-            }
             case XKB_KEY_s:
                 surface_try_focus(server, nullptr);
                 return true;
@@ -0,0 +1,231 @@
+#include "core.hpp"
+
+static const std::string state_snapshot_env = ascii_to_upper(PROGRAM_NAME) + "_STATE";
+
+template<usz N>
+static
+void state_snapshot_copy_string(char (&dst)[N], std::string_view src)
+{
+    usz count = std::min(src.size(), N - 1);
+    std::memcpy(dst, src.data(), count);
+    std::memset(dst + count, 0, N - count);
+}
+
+template<usz N>
+static
+bool state_snapshot_string_equal(const char (&recorded)[N], std::string_view src)
+{
+    return std::string_view(recorded, strnlen(recorded, N)) == src.substr(0, N - 1);
+}
+
+static
+u32 state_snapshot_output_index(Surface* surface)
+{
+    if (surface->current_outputs.empty()) return ~0u;
+
+    auto& outputs = surface->server->outputs;
+    auto output = std::ranges::find(outputs, surface->current_outputs.front());
+    return output != outputs.end() ? u32(output - outputs.begin()) : ~0u;
+}
+
+void state_snapshot_init(Server* server)
+{
+    auto& snapshot = server->snapshot;
+
+    snapshot.fd = memfd_create(PROGRAM_NAME "-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (snapshot.fd < 0) {
+        log_error("Failed to create state snapshot memfd: {}", strerror(errno));
+        return;
+    }
+
+    if (ftruncate(snapshot.fd, sizeof(StateSnapshot)) < 0) {
+        log_error("Failed to size state snapshot memfd: {}", strerror(errno));
+        state_snapshot_cleanup(server);
+        return;
+    }
+
+    void* data = mmap(nullptr, sizeof(StateSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, snapshot.fd, 0);
+    if (data == MAP_FAILED) {
+        log_error("Failed to map state snapshot memfd: {}", strerror(errno));
+        state_snapshot_cleanup(server);
+        return;
+    }
+    snapshot.data = static_cast<StateSnapshot*>(data);
+
+    // Readers open the memfd read-only through /proc. Sealing the size means a
+    // reader's mapping can never be truncated out from underneath it, and the
+    // file mode stops anyone but the compositor's own mapping writing to it
+
+    if (fcntl(snapshot.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        log_error("Failed to seal state snapshot memfd: {}", strerror(errno));
+        state_snapshot_cleanup(server);
+        return;
+    }
+    if (fchmod(snapshot.fd, 0444) < 0) {
+        log_error("Failed to make state snapshot memfd read-only: {}", strerror(errno));
+        state_snapshot_cleanup(server);
+        return;
+    }
+
+    snapshot.data->magic   = state_snapshot_magic;
+    snapshot.data->version = state_snapshot_version;
+    snapshot.data->size    = sizeof(StateSnapshot);
+    snapshot.data->focused = -1;
+
+    auto path = std::format("/proc/{}/fd/{}", getpid(), snapshot.fd);
+    log_info("Publishing state snapshot, setting {}={}", state_snapshot_env, path);
+    env_set(server, state_snapshot_env, path);
+
+    state_snapshot_mark_dirty(server);
+}
+
+void state_snapshot_mark_dirty(Server* server)
+{
+    auto& snapshot = server->snapshot;
+    if (!snapshot.data || snapshot.dirty) return;
+
+    snapshot.dirty = true;
+
+    // The snapshot is written from the next output frame, make sure there is one
+    for (Output* output : server->outputs) {
+        wlr_output_schedule_frame(output->wlr_output);
+    }
+}
+
+// Toplevels and outputs are checked on every commit and reconfigure, only mark
+// the snapshot dirty if something that was last written has actually changed
+
+void state_snapshot_check(Toplevel* toplevel)
+{
+    Server* server = toplevel->server;
+    auto& snapshot = server->snapshot;
+    if (!snapshot.data || snapshot.dirty) return;
+
+    if (!toplevel->wlr_surface->mapped) return;
+
+    auto slot = snapshot.slots.find(toplevel);
+    if (slot == snapshot.slots.end()) {
+        state_snapshot_mark_dirty(server);
+        return;
+    }
+
+    auto& entry = snapshot.data->toplevels[slot->second];
+    auto* xdg_toplevel = toplevel->xdg_toplevel();
+    wlr_box bounds = surface_get_bounds(toplevel);
+
+    bool fullscreen = entry.flags >= StateSnapshotToplevelFlags::fullscreen;
+
+    if (entry.id != toplevel->id
+            || entry.x != bounds.x || entry.y != bounds.y
+            || entry.width != bounds.width || entry.height != bounds.height
+            || entry.output != state_snapshot_output_index(toplevel)
+            || fullscreen != toplevel_is_fullscreen(toplevel)
+            || !state_snapshot_string_equal(entry.app_id, xdg_toplevel->app_id ?: "")
+            || !state_snapshot_string_equal(entry.title,  xdg_toplevel->title  ?: "")) {
+        state_snapshot_mark_dirty(server);
+    }
+}
+
+void state_snapshot_check(Output* output)
+{
+    Server* server = output->server;
+    auto& snapshot = server->snapshot;
+    if (!snapshot.data || snapshot.dirty) return;
+
+    auto index = std::ranges::find(server->outputs, output) - server->outputs.begin();
+    if (usz(index) >= snapshot.data->output_count) {
+        if (usz(index) < state_snapshot_max_outputs) state_snapshot_mark_dirty(server);
+        return;
+    }
+
+    auto& entry = snapshot.data->outputs[index];
+    wlr_box bounds = output_get_bounds(output);
+
+    if (entry.x != bounds.x || entry.y != bounds.y
+            || entry.width != bounds.width || entry.height != bounds.height
+            || entry.scale != output->wlr_output->scale
+            || !state_snapshot_string_equal(entry.name, output->wlr_output->name)) {
+        state_snapshot_mark_dirty(server);
+    }
+}
+
+void state_snapshot_update(Server* server)
+{
+    auto& snapshot = server->snapshot;
+    if (!snapshot.dirty) return;
+    snapshot.dirty = false;
+
+    StateSnapshot* data = snapshot.data;
+
+    // Seqlock, the sequence is odd for as long as the snapshot is being written
+
+    std::atomic_ref<u64> sequence(data->sequence);
+    u64 seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    data->interaction_mode = server->interaction_mode;
+
+    data->output_count = u32(std::min<usz>(server->outputs.size(), state_snapshot_max_outputs));
+    for (u32 i = 0; i < data->output_count; ++i) {
+        Output* output = server->outputs[i];
+        auto& entry = data->outputs[i];
+        wlr_box bounds = output_get_bounds(output);
+        state_snapshot_copy_string(entry.name, output->wlr_output->name);
+        entry.x      = bounds.x;
+        entry.y      = bounds.y;
+        entry.width  = bounds.width;
+        entry.height = bounds.height;
+        entry.scale  = output->wlr_output->scale;
+    }
+
+    Surface* focused = get_focused_surface(server);
+
+    snapshot.slots.clear();
+    data->focused = -1;
+    data->toplevel_count = 0;
+    for (Toplevel* toplevel : server->toplevels) {
+        if (data->toplevel_count == state_snapshot_max_toplevels) break;
+        if (!toplevel->wlr_surface->mapped) continue;
+
+        if (toplevel == focused) {
+            data->focused = i32(data->toplevel_count);
+        }
+
+        snapshot.slots.emplace(toplevel, data->toplevel_count);
+        auto& entry = data->toplevels[data->toplevel_count++];
+        auto* xdg_toplevel = toplevel->xdg_toplevel();
+        wlr_box bounds = surface_get_bounds(toplevel);
+
+        entry.id = toplevel->id;
+        state_snapshot_copy_string(entry.app_id, xdg_toplevel->app_id ?: "");
+        state_snapshot_copy_string(entry.title,  xdg_toplevel->title  ?: "");
+        entry.x      = bounds.x;
+        entry.y      = bounds.y;
+        entry.width  = bounds.width;
+        entry.height = bounds.height;
+        entry.output = state_snapshot_output_index(toplevel);
+
+        entry.flags = {};
+        if (toplevel == focused)               entry.flags |= StateSnapshotToplevelFlags::focused;
+        if (toplevel_is_fullscreen(toplevel)) entry.flags |= StateSnapshotToplevelFlags::fullscreen;
+    }
+
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+void state_snapshot_cleanup(Server* server)
+{
+    auto& snapshot = server->snapshot;
+
+    if (snapshot.data) {
+        munmap(snapshot.data, sizeof(StateSnapshot));
+        snapshot.data = nullptr;
+    }
+    if (snapshot.fd >= 0) {
+        close(snapshot.fd);
+        snapshot.fd = -1;
+    }
+    snapshot.dirty = false;
+    snapshot.slots.clear();
+}
@@ -180,6 +180,9 @@ void toplevel_update_position_for_anchor(Toplevel* toplevel)
     wlr_scene_node_set_position(&toplevel->scene_tree->node, x, y);
 
     surface_update_scale(toplevel);
+
+    script_windows_update(toplevel);
+    state_snapshot_check(toplevel);
 }
 
 void toplevel_set_bounds(Toplevel* toplevel, wlr_box box, BoundsType type, wlr_edges locked_edges)
@@ -245,26 +248,130 @@ void request_activate(wl_listener*, void* data)
 // -----------------------------------------------------------------------------
 
 static
-bool focus_cycle_toplevel_in_cycle(Toplevel* toplevel, wlr_cursor* cursor)
+bool focus_cycle_toplevel_in_cycle(Toplevel* toplevel, std::optional<vec2> scope)
 {
     return surface_is_mapped(toplevel)
-        && (!cursor || wlr_box_contains_point(ptr(surface_get_bounds(toplevel)), cursor->x, cursor->y));
+        && (!scope || wlr_box_contains_point(ptr(surface_get_bounds(toplevel)), scope->x, scope->y));
+}
+
+static
+void focus_cycle_restore(Server* server, Toplevel* toplevel)
+{
+    // Return a previously selected candidate to its original stacking position
+
+    auto& cycle = server->focus_cycle;
+
+    if (Toplevel* above = cycle.restore_above.get()) {
+        wlr_scene_node_place_above(&toplevel->scene_tree->node, &above->scene_tree->node);
+    } else if (cycle.restore_at_bottom) {
+        wlr_scene_node_lower_to_bottom(&toplevel->scene_tree->node);
+    }
+
+    toplevel_update_opacity(toplevel);
+    borders_update(toplevel);
+}
+
+static
+void focus_cycle_select(Server* server, Toplevel* toplevel)
+{
+    auto& cycle = server->focus_cycle;
+
+    cycle.restore_above.reset();
+    cycle.restore_at_bottom = false;
+
+    wlr_scene_node* node = &toplevel->scene_tree->node;
+    if (node->link.prev == &node->parent->children) {
+        cycle.restore_at_bottom = true;
+    } else {
+        wlr_scene_node* below = wl_container_of(node->link.prev, below, link);
+        cycle.restore_above = weak_from(Toplevel::from(below));
+    }
+
+    cycle.current = weak_from(toplevel);
+
+    wlr_scene_node_raise_to_top(node);
+    toplevel_update_opacity(toplevel);
+    borders_update(toplevel);
+}
+
+static
+void focus_cycle_set_current(Server* server, const FocusCycleCandidate* next)
+{
+    auto& cycle = server->focus_cycle;
+
+    Toplevel* prev = cycle.current.get();
+    Toplevel* toplevel = next ? next->toplevel.get() : nullptr;
+    if (prev == toplevel) return;
+
+    bool can_restore = !prev || (!cycle.current_has_family && (cycle.restore_above.get() || cycle.restore_at_bottom));
+
+    cycle.current.reset();
+    cycle.current_has_family = next && next->has_family;
+
+    if (!can_restore || !toplevel || next->has_family) {
+        // Parent/child groups and unknown stacking positions need a full restack
+
+        cycle.restore_above.reset();
+        cycle.restore_at_bottom = false;
+
+        if (!toplevel || next->has_family) {
+            cycle.current = weak_from(toplevel);
+            scene_reconfigure(server);
+        } else {
+            scene_reconfigure(server);
+            focus_cycle_select(server, toplevel);
+        }
+        return;
+    }
+
+    if (prev) focus_cycle_restore(server, prev);
+    focus_cycle_select(server, toplevel);
+
+    // Keep BOTTOM layer surfaces below the topmost window, as scene_reconfigure would
+
+    for (Output* output : server->outputs) {
+        if (std::ranges::contains(toplevel->current_outputs, output)
+                || (prev && std::ranges::contains(prev->current_outputs, output))) {
+            scene_update_topmost(output);
+        }
+    }
 }
 
 void focus_cycle_begin(Server* server, wlr_cursor* cursor)
 {
     set_interaction_mode(server, InteractionMode::focus_cycle);
 
-    server->focus_cycle.current.reset();
+    auto& cycle = server->focus_cycle;
+
+    cycle.current.reset();
+    cycle.candidates.clear();
+    cycle.index = 0;
+    cycle.scope = cursor ? std::optional(vec2(cursor->x, cursor->y)) : std::nullopt;
+    cycle.restore_above.reset();
+    cycle.restore_at_bottom = false;
+    cycle.current_has_family = false;
+
+    ankerl::unordered_dense::set<Toplevel*> parents;
+    for (Toplevel* toplevel : server->toplevels) {
+        if (Toplevel* parent = Toplevel::from(toplevel->xdg_toplevel()->parent)) {
+            parents.emplace(parent);
+        }
+    }
 
     for (Toplevel* toplevel : iterate<Toplevel*>(server->toplevels, true)) {
-        if (focus_cycle_toplevel_in_cycle(toplevel, cursor)) {
-            toplevel->server->focus_cycle.current = weak_from(toplevel);
-            break;
+        if (focus_cycle_toplevel_in_cycle(toplevel, cycle.scope)) {
+            cycle.candidates.emplace_back(FocusCycleCandidate {
+                .toplevel = weak_from(toplevel),
+                .has_family = toplevel->xdg_toplevel()->parent || parents.contains(toplevel),
+            });
         }
     }
 
     scene_reconfigure(server);
+
+    if (!cycle.candidates.empty()) {
+        focus_cycle_set_current(server, &cycle.candidates.front());
+    }
 }
 
 Toplevel* focus_cycle_end(Server* server)
@@ -275,45 +382,90 @@ Toplevel* focus_cycle_end(Server* server)
 
     Toplevel* selected = server->focus_cycle.current.get();
     server->focus_cycle.current.reset();
+    server->focus_cycle.candidates.clear();
+    server->focus_cycle.restore_above.reset();
 
     scene_reconfigure(server);
 
     return selected;
 }
 
-void focus_cycle_step(Server* server, wlr_cursor* cursor, bool backwards)
+void focus_cycle_step(Server* server, wlr_cursor*, bool backwards)
 {
-    // TODO: Fixup visibility if focus changes mid-cycle (e.g. window added/destroyed)
+    auto& cycle = server->focus_cycle;
 
-    Toplevel* first = nullptr;
-    bool next_is_active = false;
-    Toplevel* new_active = nullptr;
+    if (cycle.candidates.empty()) return;
 
-    for (Toplevel* toplevel : iterate<Toplevel*>(server->toplevels, !backwards)) {
-        if (!focus_cycle_toplevel_in_cycle(toplevel, cursor)) continue;
+    usz count = cycle.candidates.size();
+    cycle.index = backwards
+        ? (cycle.index + count - 1) % count
+        : (cycle.index + 1) % count;
 
-        // Is this is the first window in the cycle, mark incase we need to
-        if (!first) first = toplevel;
+    focus_cycle_set_current(server, &cycle.candidates[cycle.index]);
+}
 
-        // Previous window was active, moving to this one
-        if (next_is_active) {
-            new_active = toplevel;
-            break;
-        }
+void focus_cycle_handle_map(Toplevel* toplevel)
+{
+    Server* server = toplevel->server;
+    auto& cycle = server->focus_cycle;
+
+    if (server->interaction_mode != InteractionMode::focus_cycle) return;
 
-        // This is the first active window in the cycle, cycle to next
-        if (toplevel->server->focus_cycle.current.get() == toplevel) {
-            next_is_active = true;
+    Toplevel* parent = Toplevel::from(toplevel->xdg_toplevel()->parent);
+    for (auto& candidate : cycle.candidates) {
+        if (parent && candidate.toplevel.get() == parent) {
+            candidate.has_family = true;
+            if (parent == cycle.current.get()) cycle.current_has_family = true;
         }
-    };
+    }
+
+    // Newly mapped toplevels enter the cycle at the top of the stack
 
-    if (!new_active && first) {
-        new_active = first;
+    if (!focus_cycle_toplevel_in_cycle(toplevel, cycle.scope)) return;
+
+    cycle.candidates.insert(cycle.candidates.begin(), FocusCycleCandidate {
+        .toplevel = weak_from(toplevel),
+        .has_family = bool(parent),
+    });
+    if (cycle.current.get()) cycle.index++;
+
+    toplevel_update_opacity(toplevel);
+}
+
+void focus_cycle_handle_unmap(Toplevel* toplevel)
+{
+    Server* server = toplevel->server;
+    auto& cycle = server->focus_cycle;
+
+    if (server->interaction_mode != InteractionMode::focus_cycle) return;
+
+    auto it = std::ranges::find_if(cycle.candidates, [&](auto& c) { return c.toplevel.get() == toplevel; });
+    if (it == cycle.candidates.end()) return;
+
+    usz removed = it - cycle.candidates.begin();
+    cycle.candidates.erase(it);
+
+    if (cycle.restore_above.get() == toplevel) {
+        // Stacking neighbour is going away, fall back to a full restack on next step
+        cycle.restore_above.reset();
     }
 
-    server->focus_cycle.current = weak_from(new_active);
+    if (removed < cycle.index) {
+        cycle.index--;
+    } else if (removed == cycle.index) {
+        if (cycle.candidates.empty()) {
+            set_interaction_mode(server, InteractionMode::passthrough);
+            return;
+        }
 
-    scene_reconfigure(server);
+        // Selection moves on to the next candidate in the cycle
+        cycle.index %= cycle.candidates.size();
+        cycle.current.reset();
+        cycle.restore_above.reset();
+        cycle.restore_at_bottom = false;
+        toplevel_update_opacity(toplevel);
+        focus_cycle_set_current(server, &cycle.candidates[cycle.index]);
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -496,6 +648,10 @@ void toplevel_map(wl_listener* listener, void*)
 
     log_debug("Toplevel mapped:    {}", surface_to_string(toplevel));
 
+    toplevel->id = ++toplevel->server->next_toplevel_id;
+
+    window_rules_apply(toplevel);
+
     // wlr foreign manager
     toplevel->foreign_handle = wlr_foreign_toplevel_handle_v1_create(toplevel->server->foreign_toplevel_manager);
     if (toplevel->xdg_toplevel()->app_id) wlr_foreign_toplevel_handle_v1_set_app_id(toplevel->foreign_handle, toplevel->xdg_toplevel()->app_id);
@@ -505,7 +661,15 @@ void toplevel_map(wl_listener* listener, void*)
     // xdg foreign
     wlr_xdg_foreign_exported_init(&toplevel->foreign_exported, toplevel->server->foreign_registry);
 
+    focus_cycle_handle_map(toplevel);
+
     surface_try_focus(toplevel->server, toplevel);
+
+    script_windows_update(toplevel);
+    script_async_handle_toplevel_map(toplevel);
+    script_hook_queue_toplevel(toplevel, ScriptHookType::map);
+    ipc_publish_toplevel(toplevel, IpcTopic::map);
+    state_snapshot_mark_dirty(toplevel->server);
 }
 
 void toplevel_unmap(wl_listener* listener, void*)
@@ -520,12 +684,15 @@ void toplevel_unmap(wl_listener* listener, void*)
         set_interaction_mode(server, InteractionMode::passthrough);
     }
 
-    if (server->interaction_mode == InteractionMode::focus_cycle && toplevel == server->focus_cycle.current.get()) {
-        set_interaction_mode(server, InteractionMode::passthrough);
-    }
+    focus_cycle_handle_unmap(toplevel);
 
     update_focus(server);
 
+    script_windows_remove(toplevel);
+    script_hook_queue_toplevel(toplevel, ScriptHookType::unmap);
+    ipc_publish_toplevel(toplevel, IpcTopic::unmap);
+    state_snapshot_mark_dirty(server);
+
     if (toplevel->foreign_handle) {
         toplevel->foreign_listeners.clear();
         wlr_foreign_toplevel_handle_v1_destroy(toplevel->foreign_handle);
@@ -535,6 +702,32 @@ void toplevel_unmap(wl_listener* listener, void*)
     wlr_xdg_foreign_exported_finish(&toplevel->foreign_exported);
 }
 
+static
+void toplevel_set_app_id(wl_listener* listener, void*)
+{
+    Toplevel* toplevel = listener_userdata<Toplevel*>(listener);
+
+    window_rules_apply(toplevel);
+    if (toplevel->wlr_surface->mapped) borders_update(toplevel);
+    script_windows_update(toplevel);
+    state_snapshot_check(toplevel);
+}
+
+static
+void toplevel_set_title(wl_listener* listener, void*)
+{
+    Toplevel* toplevel = listener_userdata<Toplevel*>(listener);
+
+    if (toplevel->wlr_surface->mapped) script_hook_queue_toplevel(toplevel, ScriptHookType::title);
+    script_windows_update(toplevel);
+    state_snapshot_check(toplevel);
+
+    if (!toplevel->server->window_rules.match_title) return;
+
+    window_rules_apply(toplevel);
+    if (toplevel->wlr_surface->mapped) borders_update(toplevel);
+}
+
 static
 void toplevel_handle_initial_commit_response(Toplevel* toplevel)
 {
@@ -708,10 +901,13 @@ void toplevel_new(wl_listener* listener, void* data)
     toplevel->listeners.listen(&xdg_toplevel->events.request_maximize,   toplevel, toplevel_request_maximize);
     toplevel->listeners.listen(&xdg_toplevel->events.request_minimize,   toplevel, toplevel_request_minimize);
     toplevel->listeners.listen(&xdg_toplevel->events.request_fullscreen, toplevel, toplevel_request_fullscreen);
+    toplevel->listeners.listen(&xdg_toplevel->events.set_app_id,         toplevel, toplevel_set_app_id);
+    toplevel->listeners.listen(&xdg_toplevel->events.set_title,          toplevel, toplevel_set_title);
 
     toplevel->listeners.listen(&xdg_toplevel->base->surface->events.new_subsurface, server, subsurface_new);
 
     borders_create(toplevel);
+    window_rules_apply(toplevel);
 
     server->toplevels.emplace_back(toplevel);
 }
@@ -986,6 +1182,7 @@ void layer_surface_new(wl_listener* listener, void* data)
     layer_surface->popup_tree = wlr_scene_tree_create(server->layers[Strata::top]);
 
     borders_create(layer_surface);
+    window_rules_apply(layer_surface);
 
     output->layers[wlr_layer_surface->pending.layer].emplace_back(layer_surface);
 
@@ -1053,6 +1250,40 @@ void popup_new(wl_listener* listener, void* data)
 
 // -----------------------------------------------------------------------------
 
+static
+void scene_place_bottom_layers(Output* output)
+{
+    // BOTTOM layer surfaces are placed below the topmost window of their output
+
+    Toplevel* topmost = Toplevel::from(output->topmost.get());
+    if (!topmost) return;
+
+    for (LayerSurface* layer_surface : output->layers[ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM]) {
+        if (!layer_surface->wlr_layer_surface()->initialized) continue;
+
+        wlr_scene_node_place_below(
+            &layer_surface->scene_layer_surface->tree->node,
+            &topmost->scene_tree->node);
+    }
+}
+
+void scene_update_topmost(Output* output)
+{
+    wlr_scene_tree* tree = output->server->layers[Strata::floating];
+
+    output->topmost.reset();
+    wlr_scene_node* node;
+    wl_list_for_each_reverse(node, &tree->children, link) {
+        Toplevel* toplevel = Toplevel::from(node);
+        if (toplevel && std::ranges::contains(toplevel->current_outputs, output)) {
+            output->topmost = weak_from(toplevel);
+            break;
+        }
+    }
+
+    scene_place_bottom_layers(output);
+}
+
 void scene_reconfigure(Server* server)
 {
     std::unordered_multimap<Toplevel*, Toplevel*> parent_child;
@@ -1094,15 +1325,7 @@ void scene_reconfigure(Server* server)
     // Now move all BOTTOM layer surfaces to be placed below the topmost window for their respective output
 
     for (Output* output : server->outputs) {
-        if (!output->topmost.get()) continue;
-
-        for (LayerSurface* layer_surface : output->layers[ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM]) {
-            if (!layer_surface->wlr_layer_surface()->initialized) continue;
-
-            wlr_scene_node_place_below(
-                &layer_surface->scene_layer_surface->tree->node,
-                &output->topmost.get()->scene_tree->node);
-        }
+        scene_place_bottom_layers(output);
     }
 
     outputs_reconfigure_all(server);
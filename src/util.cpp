@@ -129,3 +129,26 @@ wlr_fbox rect_fill_compute_source_box(ivec2 source_extent, ivec2 target_extent)
         return { 0, offset, f64(source_extent.x), new_vertical };
     }
 }
+
+// -----------------------------------------------------------------------------
+
+void json_append_string(std::string& out, std::string_view str)
+{
+    out += '"';
+    for (char c : str) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if (u8(c) < 0x20) {
+                    std::format_to(std::back_inserter(out), "\\u{:04x}", u8(c));
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
@@ -103,6 +103,20 @@ constexpr auto ptr(auto&& value) { return &value; }
 
 // -----------------------------------------------------------------------------
 
+struct StringHash
+{
+    using is_transparent = void;
+    using is_avalanching = void;
+
+    u64 operator()(std::string_view str) const noexcept { return ankerl::unordered_dense::hash<std::string_view>{}(str); }
+};
+
+// String keyed map that can be looked up without allocating a key
+template<typename V>
+using StringMap = ankerl::unordered_dense::map<std::string, V, StringHash, std::equal_to<>>;
+
+// -----------------------------------------------------------------------------
+
 template<typename T, typename E>
 struct EnumMap
 {
@@ -395,6 +409,10 @@ std::string duration_to_string(std::chrono::duration<f64, std::nano> dur);
 
 // -----------------------------------------------------------------------------
 
+void json_append_string(std::string& out, std::string_view str);
+
+// -----------------------------------------------------------------------------
+
 wlr_buffer* buffer_from_pixels(wlr_allocator*, wlr_renderer*, u32 format, u32 stride, u32 width, u32 height, const void* data);
 
 // -----------------------------------------------------------------------------
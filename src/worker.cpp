@@ -0,0 +1,346 @@
+#include "core.hpp"
+
+// Worker Lua states run on background threads and share nothing with the compositor
+// state. Jobs are plain source strings with serialized arguments, results are queued
+// back to the main thread and picked up from the event loop through an eventfd
+
+namespace {
+    constexpr u32 script_worker_count      = 2;
+    constexpr u32 script_worker_max_chunks = 64;
+    constexpr u32 script_value_max_depth   = 64;
+
+    // Jobs can't be preempted from outside, so each one checks its budget and
+    // the pool's cancel flag from an instruction count hook
+    constexpr i32 script_worker_hook_interval = 1000;
+    constexpr auto script_worker_job_budget   = 10s;
+
+    enum class ScriptValueTag : u8
+    {
+        nil,
+        boolean_false,
+        boolean_true,
+        number,
+        string,
+        table,
+    };
+}
+
+struct ScriptWorkerJob
+{
+    u64 id;
+    std::string source;
+    std::string args;
+};
+
+struct ScriptWorkerResult
+{
+    u64 id;
+    bool ok;
+    std::string payload;
+};
+
+struct ScriptWorkerPool
+{
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<ScriptWorkerJob> jobs;
+    std::vector<ScriptWorkerResult> results;
+    std::atomic<bool> stop;
+
+    i32 eventfd = -1;
+    wl_event_source* source;
+
+    u64 next_id = 1;
+};
+
+// -----------------------------------------------------------------------------
+
+static
+void script_value_write(std::string& out, const void* data, usz size)
+{
+    out.append(static_cast<const char*>(data), size);
+}
+
+static
+void script_value_serialize_impl(std::string& out, sol::object value, u32 depth)
+{
+    if (depth > script_value_max_depth) {
+        throw std::runtime_error("value is nested too deeply (cyclic table?)");
+    }
+
+    switch (value.get_type()) {
+        case sol::type::lua_nil:
+            out += char(ScriptValueTag::nil);
+            break;
+        case sol::type::boolean:
+            out += char(value.as<bool>() ? ScriptValueTag::boolean_true : ScriptValueTag::boolean_false);
+            break;
+        case sol::type::number: {
+            f64 number = value.as<f64>();
+            out += char(ScriptValueTag::number);
+            script_value_write(out, &number, sizeof(number));
+            break;
+        }
+        case sol::type::string: {
+            auto str = value.as<std::string_view>();
+            u32 size = u32(str.size());
+            out += char(ScriptValueTag::string);
+            script_value_write(out, &size, sizeof(size));
+            script_value_write(out, str.data(), str.size());
+            break;
+        }
+        case sol::type::table: {
+            out += char(ScriptValueTag::table);
+            usz count_offset = out.size();
+            u32 count = 0;
+            script_value_write(out, &count, sizeof(count));
+            for (auto[k, v] : value.as<sol::table>()) {
+                script_value_serialize_impl(out, k, depth + 1);
+                script_value_serialize_impl(out, v, depth + 1);
+                count++;
+            }
+            std::memcpy(out.data() + count_offset, &count, sizeof(count));
+            break;
+        }
+        default:
+            throw std::runtime_error(std::format("cannot pass value of type {} between script states", magic_enum::enum_name(value.get_type())));
+    }
+}
+
+void script_value_serialize(std::string& out, sol::object value)
+{
+    script_value_serialize_impl(out, std::move(value), 0);
+}
+
+static
+void script_value_read(std::string_view& in, void* data, usz size)
+{
+    if (in.size() < size) throw std::runtime_error("truncated script value");
+    std::memcpy(data, in.data(), size);
+    in.remove_prefix(size);
+}
+
+sol::object script_value_deserialize(sol::state_view lua, std::string_view& in)
+{
+    ScriptValueTag tag;
+    script_value_read(in, &tag, sizeof(tag));
+
+    switch (tag) {
+        case ScriptValueTag::nil:
+            return sol::nil;
+        case ScriptValueTag::boolean_false:
+        case ScriptValueTag::boolean_true:
+            return sol::make_object(lua, tag == ScriptValueTag::boolean_true);
+        case ScriptValueTag::number: {
+            f64 number;
+            script_value_read(in, &number, sizeof(number));
+            return sol::make_object(lua, number);
+        }
+        case ScriptValueTag::string: {
+            u32 size;
+            script_value_read(in, &size, sizeof(size));
+            if (in.size() < size) throw std::runtime_error("truncated script value");
+            auto str = in.substr(0, size);
+            in.remove_prefix(size);
+            return sol::make_object(lua, str);
+        }
+        case ScriptValueTag::table: {
+            u32 count;
+            script_value_read(in, &count, sizeof(count));
+            sol::table table = lua.create_table(0, count);
+            for (u32 i = 0; i < count; ++i) {
+                auto k = script_value_deserialize(lua, in);
+                auto v = script_value_deserialize(lua, in);
+                table.raw_set(k, v);
+            }
+            return table;
+        }
+    }
+
+    throw std::runtime_error("invalid script value tag");
+}
+
+// -----------------------------------------------------------------------------
+
+static
+ScriptWorkerResult script_worker_execute(sol::state& lua, ankerl::unordered_dense::map<std::string, sol::protected_function>& chunks, ScriptWorkerJob& job)
+{
+    ScriptWorkerResult result { .id = job.id };
+
+    try {
+        // Workers are commonly sent the same source repeatedly, keep the compiled chunks around
+
+        auto chunk = chunks.find(job.source);
+        if (chunk == chunks.end()) {
+            auto loaded = lua.load(job.source, "=worker");
+            if (!loaded.valid()) {
+                sol::error err = loaded;
+                return { job.id, false, err.what() };
+            }
+            if (chunks.size() >= script_worker_max_chunks) chunks.clear();
+            chunk = chunks.emplace(job.source, loaded.get<sol::protected_function>()).first;
+        }
+
+        std::string_view args = job.args;
+        auto arg = script_value_deserialize(lua, args);
+
+        auto res = chunk->second(arg);
+        if (!res.valid()) {
+            sol::error err = res;
+            return { job.id, false, err.what() };
+        }
+
+        script_value_serialize(result.payload, res.get<sol::object>());
+        result.ok = true;
+    } catch (const std::exception& e) {
+        result.ok = false;
+        result.payload = e.what();
+    }
+
+    return result;
+}
+
+namespace {
+    thread_local struct {
+        ScriptWorkerPool* pool;
+        std::chrono::steady_clock::time_point start;
+    } script_worker_job;
+}
+
+static
+void script_worker_hook(lua_State* L, lua_Debug*)
+{
+    if (script_worker_job.pool->stop) {
+        luaL_error(L, "worker job cancelled");
+    }
+    if (std::chrono::steady_clock::now() - script_worker_job.start > script_worker_job_budget) {
+        luaL_error(L, "worker job exceeded its time budget of %s", duration_to_string(script_worker_job_budget).c_str());
+    }
+}
+
+static
+void script_worker_run(ScriptWorkerPool* pool)
+{
+    // Only pure libraries, jobs must not be able to touch the process (os.exit)
+    // or block on external input (io.read)
+
+    sol::state lua;
+    lua.open_libraries(sol::lib::base, sol::lib::string, sol::lib::table, sol::lib::math, sol::lib::bit32);
+    lua["dofile"]   = sol::nil;
+    lua["loadfile"] = sol::nil;
+
+    // The budget and stop flag are checked from a count hook, which compiled
+    // traces never call. Jobs run interpreted so that they can always be stopped
+    luaJIT_setmode(lua.lua_state(), 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+
+    script_worker_job.pool = pool;
+    lua_sethook(lua.lua_state(), script_worker_hook, LUA_MASKCOUNT, script_worker_hook_interval);
+
+    ankerl::unordered_dense::map<std::string, sol::protected_function> chunks;
+
+    for (;;) {
+        ScriptWorkerJob job;
+        {
+            std::unique_lock lock(pool->mutex);
+            pool->cv.wait(lock, [&] { return pool->stop || !pool->jobs.empty(); });
+            if (pool->stop) return;
+            job = std::move(pool->jobs.front());
+            pool->jobs.pop_front();
+        }
+
+        script_worker_job.start = std::chrono::steady_clock::now();
+        auto result = script_worker_execute(lua, chunks, job);
+
+        {
+            std::unique_lock lock(pool->mutex);
+            pool->results.emplace_back(std::move(result));
+        }
+
+        u64 one = 1;
+        auto _ = write(pool->eventfd, &one, sizeof(one));
+    }
+}
+
+static
+i32 script_workers_handle_results(i32 fd, u32 /* mask */, void* data)
+{
+    Server* server = static_cast<Server*>(data);
+    ScriptWorkerPool* pool = server->script.workers;
+
+    u64 count;
+    auto _ = read(fd, &count, sizeof(count));
+
+    std::vector<ScriptWorkerResult> results;
+    {
+        std::unique_lock lock(pool->mutex);
+        std::swap(results, pool->results);
+    }
+
+    for (auto& result : results) {
+        script_worker_complete(server, result.id, result.ok, result.payload);
+    }
+
+    return 0;
+}
+
+static
+ScriptWorkerPool* script_workers_get(Server* server)
+{
+    if (server->script.workers) return server->script.workers;
+
+    // Started on first use, most sessions never need them
+
+    auto* pool = new ScriptWorkerPool {};
+    pool->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pool->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), pool->eventfd, WL_EVENT_READABLE, script_workers_handle_results, server);
+
+    for (u32 i = 0; i < script_worker_count; ++i) {
+        pool->threads.emplace_back(script_worker_run, pool);
+    }
+
+    log_info("Started {} script worker(s)", script_worker_count);
+
+    return server->script.workers = pool;
+}
+
+u64 script_worker_submit(Server* server, std::string source, std::string args)
+{
+    ScriptWorkerPool* pool = script_workers_get(server);
+
+    u64 id = pool->next_id++;
+    {
+        std::unique_lock lock(pool->mutex);
+        pool->jobs.emplace_back(ScriptWorkerJob { id, std::move(source), std::move(args) });
+    }
+    pool->cv.notify_one();
+
+    return id;
+}
+
+void script_workers_cleanup(Server* server)
+{
+    ScriptWorkerPool* pool = server->script.workers;
+    if (!pool) return;
+
+    {
+        std::unique_lock lock(pool->mutex);
+        pool->stop = true;
+        pool->jobs.clear();
+    }
+    pool->cv.notify_all();
+
+    // Running jobs observe the stop flag from their count hook and error out, the
+    // JIT is off in workers so the hook fires in every loop
+    for (auto& thread : pool->threads) {
+        thread.join();
+    }
+
+    wl_event_source_remove(pool->source);
+    close(pool->eventfd);
+
+    delete pool;
+    server->script.workers = nullptr;
+    server->script.worker_pending.clear();
+}